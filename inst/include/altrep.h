@@ -0,0 +1,365 @@
+#ifndef QUANTEDA_ALTREP // prevent redefining
+#define QUANTEDA_ALTREP
+
+// included at the end of tokens.h
+#include <cstring>
+#include <numeric>
+
+// ALTREP is usable from C++ since R 3.6.0 and lists since R 4.3.0
+#if R_VERSION >= R_Version(3, 6, 0)
+#define QUANTEDA_USE_ALTREP true
+#include <R_ext/Altrep.h>
+#else
+#define QUANTEDA_USE_ALTREP false
+#endif
+#if QUANTEDA_USE_ALTREP && R_VERSION >= R_Version(4, 3, 0)
+#define QUANTEDA_USE_ALTLIST true
+#else
+#define QUANTEDA_USE_ALTLIST false
+#endif
+
+/*
+ * Vectors that expose documents and types of tokens_xptr to R without copying
+ * them until they are used
+ *
+ * types    character vector whose elements are converted from Types when they
+ *          are accessed
+ * view     integer vector pointing to token IDs of a document in TokensObj; it
+ *          is copied only when R asks for a writable pointer
+ * texts    list whose elements are created when they are accessed
+ *
+ * The objects keep a snapshot of TokensObj (or its types) that shares memory
+ * with the original object, so the original can be modified freely. The
+ * classes are registered by register_altrep() when the package is loaded;
+ * otherwise ordinary vectors are created.
+ */
+
+// shorter documents are copied because views need more allocations
+const R_xlen_t ALTREP_VIEW_MIN_LENGTH = 128;
+
+#if QUANTEDA_USE_ALTREP
+
+typedef std::shared_ptr<const Types> TypesPtr;
+
+inline R_altrep_class_t& altrep_types_class() {
+    static R_altrep_class_t cls = {NULL};
+    return cls;
+}
+
+inline R_altrep_class_t& altrep_view_class() {
+    static R_altrep_class_t cls = {NULL};
+    return cls;
+}
+
+// types ---------------------------------------------------------------
+
+inline void finalize_types(SEXP ptr_) {
+    TypesPtr *ptr = (TypesPtr*)R_ExternalPtrAddr(ptr_);
+    if (ptr)
+        delete ptr;
+    R_ClearExternalPtr(ptr_);
+}
+
+inline const Types& altrep_types_get(SEXP x) {
+    return **(TypesPtr*)R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+inline R_xlen_t altrep_types_length(SEXP x) {
+    if (R_altrep_data1(x) == R_NilValue)
+        return XLENGTH(R_altrep_data2(x));
+    return altrep_types_get(x).size();
+}
+
+// converted types are cached in data2; NA marks types not converted yet
+inline SEXP altrep_types_cache(SEXP x) {
+    SEXP cache_ = R_altrep_data2(x);
+    if (cache_ == R_NilValue) {
+        R_xlen_t n = altrep_types_length(x);
+        cache_ = PROTECT(Rf_allocVector(STRSXP, n));
+        for (R_xlen_t i = 0; i < n; i++)
+            SET_STRING_ELT(cache_, i, NA_STRING);
+        R_set_altrep_data2(x, cache_);
+        UNPROTECT(1);
+    }
+    return cache_;
+}
+
+inline SEXP altrep_types_elt(SEXP x, R_xlen_t i) {
+    if (R_altrep_data1(x) == R_NilValue)
+        return STRING_ELT(R_altrep_data2(x), i);
+    SEXP cache_ = altrep_types_cache(x);
+    SEXP type_ = STRING_ELT(cache_, i);
+    if (type_ == NA_STRING) {
+        const Type &type = altrep_types_get(x)[i];
+        type_ = Rf_mkCharLenCE(type.data(), type.size(), CE_UTF8);
+        SET_STRING_ELT(cache_, i, type_);
+    }
+    return type_;
+}
+
+// convert all the types and release the snapshot
+inline SEXP altrep_types_expand(SEXP x) {
+    if (R_altrep_data1(x) != R_NilValue) {
+        R_xlen_t n = altrep_types_length(x);
+        for (R_xlen_t i = 0; i < n; i++)
+            altrep_types_elt(x, i);
+        R_set_altrep_data1(x, R_NilValue);
+    }
+    return R_altrep_data2(x);
+}
+
+inline void* altrep_types_dataptr(SEXP x, Rboolean writeable) {
+    return DATAPTR(altrep_types_expand(x));
+}
+
+inline const void* altrep_types_dataptr_or_null(SEXP x) {
+    if (R_altrep_data1(x) == R_NilValue)
+        return DATAPTR(R_altrep_data2(x));
+    return NULL;
+}
+
+inline void altrep_types_set_elt(SEXP x, R_xlen_t i, SEXP v) {
+    SET_STRING_ELT(altrep_types_expand(x), i, v);
+}
+
+inline int altrep_types_no_na(SEXP x) {
+    return R_altrep_data1(x) != R_NilValue; // types are never NA
+}
+
+inline SEXP altrep_types_duplicate(SEXP x, Rboolean deep) {
+    SEXP cache_ = R_altrep_data2(x);
+    if (cache_ != R_NilValue)
+        cache_ = Rf_duplicate(cache_);
+    PROTECT(cache_);
+    SEXP result_ = R_new_altrep(altrep_types_class(), R_altrep_data1(x), cache_);
+    UNPROTECT(1);
+    return result_;
+}
+
+// view ----------------------------------------------------------------
+
+// token IDs are in the address of data1 and the length is in its tag
+inline const int* altrep_view_data(SEXP x) {
+    return (const int*)R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+inline R_xlen_t altrep_view_length(SEXP x) {
+    return (R_xlen_t)REAL(R_ExternalPtrTag(R_altrep_data1(x)))[0];
+}
+
+inline SEXP altrep_view_expand(SEXP x) {
+    SEXP copy_ = R_altrep_data2(x);
+    if (copy_ == R_NilValue) {
+        R_xlen_t n = altrep_view_length(x);
+        copy_ = PROTECT(Rf_allocVector(INTSXP, n));
+        std::memcpy(INTEGER(copy_), altrep_view_data(x), n * sizeof(int));
+        R_set_altrep_data2(x, copy_);
+        UNPROTECT(1);
+    }
+    return copy_;
+}
+
+inline void* altrep_view_dataptr(SEXP x, Rboolean writeable) {
+    if (writeable)
+        return DATAPTR(altrep_view_expand(x));
+    if (R_altrep_data2(x) != R_NilValue)
+        return DATAPTR(R_altrep_data2(x));
+    return (void*)altrep_view_data(x); // R does not write to this
+}
+
+inline const void* altrep_view_dataptr_or_null(SEXP x) {
+    return altrep_view_dataptr(x, FALSE);
+}
+
+inline int altrep_view_elt(SEXP x, R_xlen_t i) {
+    return ((const int*)altrep_view_dataptr(x, FALSE))[i];
+}
+
+inline R_xlen_t altrep_view_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    R_xlen_t len = altrep_view_length(x);
+    R_xlen_t size = std::min(n, len - i);
+    const int *data = (const int*)altrep_view_dataptr(x, FALSE);
+    std::copy(data + i, data + i + size, buf);
+    return size;
+}
+
+inline SEXP altrep_view_duplicate(SEXP x, Rboolean deep) {
+    SEXP copy_ = R_altrep_data2(x);
+    if (copy_ != R_NilValue)
+        copy_ = Rf_duplicate(copy_);
+    PROTECT(copy_);
+    SEXP result_ = R_new_altrep(altrep_view_class(), R_altrep_data1(x), copy_);
+    UNPROTECT(1);
+    return result_;
+}
+
+#endif
+
+// types as a character vector that converts them only when they are used
+inline CharacterVector lazy_types(std::shared_ptr<const Types> types) {
+#if QUANTEDA_USE_ALTREP
+    if (altrep_types_class().ptr == NULL)
+        return encode_types(*types);
+    SEXP ptr_ = PROTECT(R_MakeExternalPtr(new TypesPtr(types), R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(ptr_, finalize_types, TRUE);
+    SEXP result_ = R_new_altrep(altrep_types_class(), ptr_, R_NilValue);
+    UNPROTECT(1);
+    return result_;
+#else
+    return encode_types(*types);
+#endif
+}
+
+// a document as an integer vector; snapshot_ keeps token IDs alive
+inline SEXP text_vector(const TokensObj &obj, std::size_t h, SEXP snapshot_) {
+    TextView text = obj.text(h);
+#if QUANTEDA_USE_ALTREP
+    if (altrep_view_class().ptr != NULL && !obj.compact &&
+        (R_xlen_t)text.size() >= ALTREP_VIEW_MIN_LENGTH) {
+        SEXP len_ = PROTECT(Rf_ScalarReal(text.size()));
+        SEXP ptr_ = PROTECT(R_MakeExternalPtr((void*)text.begin(), len_, snapshot_));
+        SEXP result_ = R_new_altrep(altrep_view_class(), ptr_, R_NilValue);
+        UNPROTECT(2);
+        return result_;
+    }
+#endif
+    SEXP result_ = PROTECT(Rf_allocVector(INTSXP, text.size()));
+    std::copy(text.begin(), text.end(), INTEGER(result_));
+    UNPROTECT(1);
+    return result_;
+}
+
+#if QUANTEDA_USE_ALTLIST
+
+inline R_altrep_class_t& altrep_texts_class() {
+    static R_altrep_class_t cls = {NULL};
+    return cls;
+}
+
+// texts -----------------------------------------------------------------
+
+inline R_xlen_t altrep_texts_length(SEXP x) {
+    if (R_altrep_data1(x) == R_NilValue)
+        return XLENGTH(R_altrep_data2(x));
+    XPtr<TokensObj> snapshot(R_altrep_data1(x));
+    const TokensObj &obj = *snapshot;
+    return obj.size();
+}
+
+// documents are cached in data2 once they are created
+inline SEXP altrep_texts_elt(SEXP x, R_xlen_t i) {
+    SEXP snapshot_ = R_altrep_data1(x);
+    SEXP cache_ = R_altrep_data2(x);
+    if (snapshot_ == R_NilValue)
+        return VECTOR_ELT(cache_, i);
+    if (cache_ == R_NilValue) {
+        cache_ = PROTECT(Rf_allocVector(VECSXP, altrep_texts_length(x)));
+        R_set_altrep_data2(x, cache_);
+        UNPROTECT(1);
+    }
+    SEXP text_ = VECTOR_ELT(cache_, i);
+    if (text_ == R_NilValue) {
+        XPtr<TokensObj> snapshot(snapshot_);
+        const TokensObj &obj = *snapshot;
+        text_ = PROTECT(text_vector(obj, i, snapshot_));
+        SET_VECTOR_ELT(cache_, i, text_);
+        UNPROTECT(1);
+    }
+    return text_;
+}
+
+// create all the documents and release the snapshot
+inline SEXP altrep_texts_expand(SEXP x) {
+    if (R_altrep_data1(x) != R_NilValue) {
+        R_xlen_t n = altrep_texts_length(x);
+        for (R_xlen_t i = 0; i < n; i++)
+            altrep_texts_elt(x, i);
+        R_set_altrep_data1(x, R_NilValue);
+    }
+    return R_altrep_data2(x);
+}
+
+inline void* altrep_texts_dataptr(SEXP x, Rboolean writeable) {
+    return DATAPTR(altrep_texts_expand(x));
+}
+
+inline const void* altrep_texts_dataptr_or_null(SEXP x) {
+    if (R_altrep_data1(x) == R_NilValue)
+        return DATAPTR(R_altrep_data2(x));
+    return NULL;
+}
+
+inline void altrep_texts_set_elt(SEXP x, R_xlen_t i, SEXP v) {
+    SET_VECTOR_ELT(altrep_texts_expand(x), i, v);
+}
+
+// shallow copies share the snapshot and the documents already created
+inline SEXP altrep_texts_duplicate(SEXP x, Rboolean deep) {
+    if (deep)
+        return NULL; // copied by R
+    SEXP cache_ = R_altrep_data2(x);
+    if (cache_ != R_NilValue)
+        cache_ = Rf_shallow_duplicate(cache_);
+    PROTECT(cache_);
+    SEXP result_ = R_new_altrep(altrep_texts_class(), R_altrep_data1(x), cache_);
+    UNPROTECT(1);
+    return result_;
+}
+
+#endif
+
+// documents as a list that creates them only when they are used
+inline List lazy_texts(const TokensObj &obj) {
+    std::vector<std::size_t> index(obj.size());
+    std::iota(index.begin(), index.end(), 0);
+    XPtr<TokensObj> snapshot(new TokensObj(obj.subset(index)), true);
+    SEXP snapshot_ = PROTECT(snapshot);
+#if QUANTEDA_USE_ALTLIST
+    if (altrep_texts_class().ptr != NULL) {
+        SEXP result_ = R_new_altrep(altrep_texts_class(), snapshot_, R_NilValue);
+        UNPROTECT(1);
+        return result_;
+    }
+#endif
+    List texts_(obj.size());
+    for (std::size_t h = 0; h < obj.size(); h++)
+        texts_[h] = text_vector(obj, h, snapshot_);
+    UNPROTECT(1);
+    return texts_;
+}
+
+// called in R_init_quanteda()
+inline void register_altrep(DllInfo *dll) {
+#if QUANTEDA_USE_ALTREP
+    R_altrep_class_t types = R_make_altstring_class("tokens_types", "quanteda", dll);
+    R_set_altrep_Length_method(types, altrep_types_length);
+    R_set_altrep_Duplicate_method(types, altrep_types_duplicate);
+    R_set_altvec_Dataptr_method(types, altrep_types_dataptr);
+    R_set_altvec_Dataptr_or_null_method(types, altrep_types_dataptr_or_null);
+    R_set_altstring_Elt_method(types, altrep_types_elt);
+    R_set_altstring_Set_elt_method(types, altrep_types_set_elt);
+    R_set_altstring_No_NA_method(types, altrep_types_no_na);
+    altrep_types_class() = types;
+
+    R_altrep_class_t view = R_make_altinteger_class("tokens_view", "quanteda", dll);
+    R_set_altrep_Length_method(view, altrep_view_length);
+    R_set_altrep_Duplicate_method(view, altrep_view_duplicate);
+    R_set_altvec_Dataptr_method(view, altrep_view_dataptr);
+    R_set_altvec_Dataptr_or_null_method(view, altrep_view_dataptr_or_null);
+    R_set_altinteger_Elt_method(view, altrep_view_elt);
+    R_set_altinteger_Get_region_method(view, altrep_view_get_region);
+    altrep_view_class() = view;
+#endif
+#if QUANTEDA_USE_ALTLIST
+    R_altrep_class_t texts = R_make_altlist_class("tokens_texts", "quanteda", dll);
+    R_set_altrep_Length_method(texts, altrep_texts_length);
+    R_set_altrep_Duplicate_method(texts, altrep_texts_duplicate);
+    R_set_altvec_Dataptr_method(texts, altrep_texts_dataptr);
+    R_set_altvec_Dataptr_or_null_method(texts, altrep_texts_dataptr_or_null);
+    R_set_altlist_Elt_method(texts, altrep_texts_elt);
+    R_set_altlist_Set_elt_method(texts, altrep_texts_set_elt);
+    altrep_texts_class() = texts;
+#endif
+}
+
+#endif
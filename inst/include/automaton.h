@@ -0,0 +1,201 @@
+#ifndef QUANTEDA_AUTOMATON // prevent redefining
+#define QUANTEDA_AUTOMATON
+
+#include "lib.h"
+using namespace quanteda;
+
+namespace quanteda{
+
+    // position and length of a matched pattern; values are obtained by
+    // Automaton::values()
+    struct Hit {
+        std::size_t pos;
+        std::size_t span;
+        unsigned int node;
+    };
+    typedef std::vector<Hit> Hits;
+
+    /*
+     * Aho-Corasick automaton over token IDs that finds all the occurrences
+     * of patterns of any length in a single pass
+     * insert() patterns and compile() before calling match() and values()
+     */
+    class Automaton {
+        public:
+            Automaton(): version(0), nodes(1, Node(0)), count(0), span_max(0) {}
+
+            uint64_t version; // version of types for which patterns are compiled
+
+            bool insert(const Ngram &pattern, unsigned int value, bool multiple = false);
+            void compile();
+            std::size_t size() const { return count; }
+            std::size_t max_span() const { return span_max; }
+            Hits match(const TextView &tokens) const;
+            const std::vector<unsigned int>& values(const Hit &hit) const {
+                return nodes[hit.node].values;
+            }
+
+        private:
+            struct Node {
+                Node(unsigned int depth_): fail(0), link(0), depth(depth_), leaf(true) {}
+                unsigned int fail; // longest suffix that is also a prefix of patterns
+                unsigned int link; // longest suffix that is also a pattern
+                unsigned int depth;
+                bool leaf; // no transition to other nodes
+                std::vector<unsigned int> values;
+                std::vector< std::pair<unsigned int, unsigned int> > children; // only for compile()
+            };
+            std::vector<Node> nodes;
+            std::vector<unsigned int> roots; // transitions from the root by token IDs
+            std::unordered_map<uint64_t, unsigned int> edges; // transitions from other nodes
+            std::size_t count;
+            std::size_t span_max;
+
+            static uint64_t key(unsigned int node, unsigned int id) {
+                return ((uint64_t)node << 32) | id;
+            }
+            unsigned int next(unsigned int node, unsigned int id) const;
+            unsigned int add(unsigned int node, unsigned int id);
+    };
+
+    // transition to the next node; zero if there is no transition
+    inline unsigned int Automaton::next(unsigned int node, unsigned int id) const {
+        if (node == 0)
+            return id < roots.size() ? roots[id] : 0;
+        if (nodes[node].leaf)
+            return 0;
+        auto it = edges.find(key(node, id));
+        if (it == edges.end())
+            return 0;
+        return it->second;
+    }
+
+    inline unsigned int Automaton::add(unsigned int node, unsigned int id) {
+        unsigned int child = next(node, id);
+        if (child > 0)
+            return child;
+        child = nodes.size();
+        nodes.push_back(Node(nodes[node].depth + 1));
+        nodes[node].leaf = false;
+        nodes[node].children.push_back(std::make_pair(id, child));
+        if (node == 0) {
+            if (id >= roots.size())
+                roots.resize(id + 1, 0);
+            roots[id] = child;
+        } else {
+            edges.insert(std::make_pair(key(node, id), child));
+        }
+        return child;
+    }
+
+    // register a pattern; values of the same pattern are kept only if multiple is true
+    inline bool Automaton::insert(const Ngram &pattern, unsigned int value, bool multiple) {
+        if (pattern.size() == 0)
+            return false; // ignore empty patterns
+        unsigned int node = 0;
+        for (unsigned int id : pattern)
+            node = add(node, id);
+        span_max = std::max(span_max, pattern.size());
+        std::vector<unsigned int> &values = nodes[node].values;
+        if (values.size() == 0) {
+            values.push_back(value);
+            count++;
+            return true;
+        } else if (multiple) {
+            values.push_back(value);
+        }
+        return false;
+    }
+
+    // set failure and output links in breadth-first order
+    inline void Automaton::compile() {
+        std::vector<unsigned int> queue;
+        queue.reserve(nodes.size());
+        for (auto &child : nodes[0].children)
+            queue.push_back(child.second);
+        for (std::size_t k = 0; k < queue.size(); k++) {
+            unsigned int node = queue[k];
+            for (auto &child : nodes[node].children) {
+                unsigned int id = child.first;
+                unsigned int fail = nodes[node].fail;
+                unsigned int target = next(fail, id);
+                while (target == 0 && fail != 0) {
+                    fail = nodes[fail].fail;
+                    target = next(fail, id);
+                }
+                Node &node_child = nodes[child.second];
+                node_child.fail = target;
+                node_child.link = nodes[target].values.size() > 0 ? target : nodes[target].link;
+                queue.push_back(child.second);
+            }
+        }
+        for (auto &node : nodes)
+            std::vector< std::pair<unsigned int, unsigned int> >().swap(node.children);
+    }
+
+    // find all the matches in the order of longer spans and earlier positions
+    // as the loops over spans and positions
+    inline Hits Automaton::match(const TextView &tokens) const {
+        Hits hits;
+        if (span_max == 1) {
+            // only look up the IDs of single tokens
+            std::size_t G = roots.size();
+            for (std::size_t i = 0; i < tokens.size(); i++) {
+                unsigned int id = tokens[i];
+                unsigned int node = id < G ? roots[id] : 0;
+                if (node != 0)
+                    hits.push_back({i, 1, node});
+            }
+            return hits;
+        }
+        unsigned int node = 0;
+        for (std::size_t i = 0; i < tokens.size(); i++) {
+            unsigned int id = tokens[i];
+            unsigned int target = next(node, id);
+            while (target == 0 && node != 0) {
+                node = nodes[node].fail;
+                target = next(node, id);
+            }
+            node = target;
+            unsigned int out = nodes[node].values.size() > 0 ? node : nodes[node].link;
+            while (out != 0) {
+                std::size_t span = nodes[out].depth;
+                hits.push_back({i + 1 - span, span, out});
+                out = nodes[out].link;
+            }
+        }
+        if (hits.size() > 1) {
+            std::sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+                return a.span > b.span || (a.span == b.span && a.pos < b.pos);
+            });
+        }
+        return hits;
+    }
+
+    // values are the indices of patterns
+    inline void register_ngrams(const List &patterns_, Automaton &automaton) {
+        Ngrams patterns = Rcpp::as<Ngrams>(patterns_);
+        for (size_t g = 0; g < patterns.size(); g++)
+            automaton.insert(patterns[g], g, true);
+        automaton.compile();
+    }
+    
+    typedef XPtr<Automaton> PatternsPtr;
+    
+    // use patterns compiled by cpp_compile_patterns() or compile them
+    inline const Automaton& get_patterns(const List &patterns_, 
+                                         const TokensObj &obj,
+                                         Automaton &automaton) {
+        SEXP compiled_ = Rf_getAttrib(patterns_, Rf_install("compiled"));
+        if (TYPEOF(compiled_) == EXTPTRSXP) {
+            PatternsPtr ptr(compiled_);
+            if (ptr->version != obj.types_version())
+                throw std::range_error("Compiled pattern is not for the types of the tokens");
+            return *ptr;
+        }
+        register_ngrams(patterns_, automaton);
+        return automaton;
+    }
+}
+
+#endif
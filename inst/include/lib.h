@@ -14,19 +14,10 @@ using namespace Rcpp;
 // [[Rcpp::depends(RcppParallel)]]
 using namespace RcppParallel;
 
-#define CLANG_VERSION (__clang_major__ * 10000 + __clang_minor__ * 100 + __clang_patchlevel__)
-
 // NOTE: used in textstats
 const float GLOBAL_PATTERN_MAX_LOAD_FACTOR = 0.05;
 const float GLOBAL_NGRAMS_MAX_LOAD_FACTOR = 0.25;
 
-// compiler has to be newer than clang 3.30 or gcc 4.8.1
-#if RCPP_PARALLEL_USE_TBB && (CLANG_VERSION >= 30300 || GCC_VERSION >= 40801) 
-#define QUANTEDA_USE_TBB true // tbb.h is loaded automatically by RcppParallel.h
-#else
-#define QUANTEDA_USE_TBB false
-#endif
-
 namespace quanteda{
     
     typedef ListOf<IntegerVector> Tokens;
@@ -62,13 +53,30 @@ namespace quanteda{
     typedef std::vector<unsigned int> Ngram;
     typedef std::vector<Ngram> Ngrams;
     
+    // mix bits of a 64-bit integer (finalizer of splitmix64)
+    inline uint64_t mix_hash(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+    
+    // order-sensitive hash of token IDs
     struct hash_ngram {
         std::size_t operator() (const Ngram &vec) const {
-            unsigned int seed = 0;
+            uint64_t seed = vec.size();
             for (std::size_t i = 0; i < vec.size(); i++) {
-                seed += vec[i] * (256 ^ i);
+                seed = mix_hash(seed + vec[i] + 0x9e3779b97f4a7c15ULL);
             }
-            return std::hash<unsigned int>()(seed);
+            return (std::size_t)seed;
+        }
+    };
+    
+    struct hash_pair {
+        std::size_t operator() (const std::pair<unsigned int, unsigned int> &p) const {
+            return (std::size_t)mix_hash(((uint64_t)p.first << 32) | p.second);
         }
     };
     
@@ -115,9 +123,15 @@ namespace quanteda{
     inline std::string join_strings(std::vector<std::string> &tokens, 
                                     const std::string &delim = " "){
         if (tokens.size() == 0) return "";
-        std::string token = tokens[0];
+        std::size_t len = delim.size() * (tokens.size() - 1);
+        for (std::size_t i = 0; i < tokens.size(); i++)
+            len += tokens[i].size();
+        std::string token;
+        token.reserve(len); // allocate only once
+        token += tokens[0];
         for (std::size_t i = 1; i < tokens.size(); i++) {
-          token += delim + tokens[i];
+          token += delim;
+          token += tokens[i];
         }
         return token;
     }
@@ -149,6 +163,12 @@ namespace quanteda{
 
         std::string token("");
         if (tokens.size() > 0) {
+            std::size_t len = delim.size() * (tokens.size() - 1);
+            for (std::size_t j = 0; j < tokens.size(); j++) {
+                if (tokens[j] != 0)
+                    len += types[tokens[j] - 1].size();
+            }
+            token.reserve(len); // allocate only once
             if (tokens[0] != 0) {
                 token += types[tokens[0] - 1];
             }
@@ -179,14 +199,8 @@ namespace quanteda{
         return false;
     }
     
-    inline CharacterVector encode(Types &types){
-        CharacterVector types_(types.size());
-        for (std::size_t i = 0; i < types.size(); i++) {
-            String type_ = types[i];
-            type_.set_encoding(CE_UTF8);
-            types_[i] = type_;
-        }
-        return(types_);
+    inline CharacterVector encode(const Types &types){
+        return encode_types(types);
     }
     
     inline bool has_na(IntegerVector vec_) {
@@ -205,6 +219,16 @@ namespace quanteda{
       return texts_;
     }
     
+    inline List as_list(const TokensObj &obj){
+      List texts_(obj.size());
+      for (std::size_t h = 0; h < obj.size(); h++) {
+        TextView text = obj.text(h);
+        IntegerVector text_ = IntegerVector(text.begin(), text.end());
+        texts_[h] = text_;
+      }
+      return texts_;
+    }
+    
     inline S4 to_matrix(Triplets& tri, int nrow, int ncol, bool symmetric) {
         
         std::size_t l = tri.size();
@@ -8,22 +8,12 @@ typedef tbb::concurrent_vector<unsigned int> VecIds;
 typedef std::vector<unsigned int> VecIds;
 #endif
 
-inline bool is_duplicated(Types types){
-    std::sort(types.begin(), types.end());
-    if (types.size() <= 1) return false;
-    for (std::size_t i = 0; i < types.size() - 1; i++) {
-        if (types[i] != "" && types[i] == types[i + 1]) {
-            return true;
-        }
-    }
-    return false;
-}
-
 inline Tokens recompile(Texts texts, 
                         Types types, 
                         const bool flag_gap = true, 
                         const bool flag_dup = true,
-                        const bool flag_encode = true){
+                        const bool flag_encode = true,
+                        const int thread = 1){
 
     VecIds ids_new(types.size() + 1);
     ids_new[0] = 0; // reserved for padding
@@ -36,19 +26,11 @@ inline Tokens recompile(Texts texts,
     
     // Check if IDs are all used
     bool all_used;
+    std::size_t H = texts.size();
+    auto text = [&](std::size_t h) { return TextView(texts[h]); };
     if (flag_gap) {
         // dev::start_timer("Check gaps", timer);
-        unsigned int id_limit = ids_new.size();
-        for (std::size_t h = 0; h < texts.size(); h++) {
-            for (std::size_t i = 0; i < texts[h].size(); i++) {
-                unsigned int id = texts[h][i];
-                if (id > id_limit) {
-                    throw std::range_error("Invalid tokens object");
-                }
-                flags_used[id] = true;
-                // Rcout << setw(10) << id << ": used" << "\n";
-            }
-        }
+        flags_used = flag_used(H, types.size(), text, thread);
         all_used = std::all_of(flags_used.begin(), flags_used.end(), [](bool v) { return v; });
         // dev::stop_timer("Check gaps", timer);
     } else {
@@ -56,13 +38,7 @@ inline Tokens recompile(Texts texts,
         std::fill(flags_used.begin() + 1, flags_used.end(), true);
         
         // Only check for padding
-        for (std::size_t h = 0; h < texts.size() && !flags_used[0]; h++) {
-            for (std::size_t i = 0; i < texts[h].size() && !flags_used[0]; i++) {
-                if (texts[h][i] == 0) {
-                    flags_used[0] = true;
-                }
-            }
-        }
+        flags_used[0] = has_padding(H, text, thread);
         all_used = true;
     }
     
@@ -70,12 +46,13 @@ inline Tokens recompile(Texts texts,
     bool all_unique;
     if (flag_dup && is_duplicated(types)) {
         // dev::start_timer("Check duplication", timer);
-        std::unordered_map<std::string, unsigned int> types_unique;
+        MapTypePtrs types_unique;
+        types_unique.reserve(types.size());
         flags_unique[0] = true; // padding is always unique
         for (std::size_t g = 1; g < ids_new.size(); g++) {
             if (types[g - 1] == "") continue; // ignore null types
             if (!flags_used[g]) continue; // ignore unused
-            auto it = types_unique.insert(std::pair<std::string, unsigned int>(types[g - 1], id_new));
+            auto it = types_unique.insert(std::make_pair(&types[g - 1], id_new));
             ids_new[g] = it.first->second;
             if (it.second) {
                 flags_unique[g] = true;
@@ -115,13 +92,24 @@ inline Tokens recompile(Texts texts,
     //dev::start_timer("Convert IDs", timer);
     
     // Convert old IDs to new IDs
-    std::size_t H = texts.size();
+#if QUANTEDA_USE_TBB
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
+            for (int h = r.begin(); h < r.end(); ++h) {
+                for (std::size_t i = 0; i < texts[h].size(); i++)
+                    texts[h][i] = ids_new[texts[h][i]];
+            }
+        });
+    });
+#else
     for (std::size_t h = 0; h < H; h++) {
         for (std::size_t i = 0; i < texts[h].size(); i++) {
             texts[h][i] = ids_new[texts[h][i]];
             //Rcout << texts[h][i] << " -> " << ids_new[texts[h][i]] << "\n";
         }
     }
+#endif
 
     std::vector<std::string> types_new;
     types_new.reserve(ids_new.size());
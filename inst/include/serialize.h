@@ -0,0 +1,208 @@
+#ifndef QUANTEDA_SERIALIZE // prevent redefining
+#define QUANTEDA_SERIALIZE
+
+#include "lib.h"
+using namespace quanteda;
+
+namespace quanteda{
+
+    // characters of a token referenced without copying
+    struct Chars {
+        const char *ptr;
+        std::size_t len;
+    };
+
+    struct hash_chars {
+        std::size_t operator() (const Chars &str) const {
+            uint64_t seed = 0xcbf29ce484222325ULL; // FNV-1a
+            for (std::size_t i = 0; i < str.len; i++) {
+                seed ^= (unsigned char)str.ptr[i];
+                seed *= 0x100000001b3ULL;
+            }
+            return mix_hash(seed);
+        }
+    };
+
+    struct equal_chars {
+        bool operator() (const Chars &str1, const Chars &str2) const {
+            return str1.len == str2.len &&
+                   (str1.ptr == str2.ptr || std::memcmp(str1.ptr, str2.ptr, str1.len) == 0);
+        }
+    };
+
+    typedef std::pair<unsigned int, unsigned int> Position; // block and local ID
+    typedef std::unordered_map<Chars, unsigned int, hash_chars, equal_chars> MapChars;
+    typedef std::unordered_map<Chars, Position, hash_chars, equal_chars> MapFirst;
+
+    /*
+     * Documents are serialized in blocks without sharing a dictionary between
+     * threads:
+     * 1. each block registers types to its own dictionary in the order of first
+     *    occurrence and converts tokens to local IDs;
+     * 2. local types are divided into shards by their hash values, and each shard
+     *    finds the first occurrence of the new types scanning blocks in order;
+     * 3. new types are sorted by their first occurrence and given global IDs;
+     * 4. local IDs are converted to global IDs in each block.
+     * Global IDs are therefore in the order of first occurrence in the documents
+     * regardless of the number of blocks and threads.
+     */
+    struct Block {
+        std::size_t begin; // first document
+        std::size_t end;
+        std::vector<Chars> types; // local types
+        std::vector<unsigned int> ids; // global IDs of local types
+        std::vector<Position> firsts; // first occurrences of new local types
+        std::vector<unsigned int> order; // local IDs sorted by shards
+        std::vector<std::size_t> offsets; // positions of shards in order
+    };
+    typedef std::vector<Block> Blocks;
+
+    // register a token to the dictionary of a block and return its local ID
+    inline unsigned int local_id(Block &block, MapChars &map, const Chars &token) {
+        auto it = map.insert(std::make_pair(token, map.size() + 1));
+        if (it.second)
+            block.types.push_back(token);
+        return it.first->second;
+    }
+
+    // counting sort of local types by shards
+    inline void sort_block(Block &block, std::size_t P) {
+        std::size_t L = block.types.size();
+        std::vector<std::size_t> shards(L);
+        block.offsets.assign(P + 1, 0);
+        for (std::size_t l = 0; l < L; l++) {
+            shards[l] = hash_chars()(block.types[l]) % P;
+            block.offsets[shards[l] + 1]++;
+        }
+        for (std::size_t s = 0; s < P; s++)
+            block.offsets[s + 1] += block.offsets[s];
+        std::vector<std::size_t> pos(block.offsets.begin(), block.offsets.end() - 1);
+        block.order.resize(L);
+        for (std::size_t l = 0; l < L; l++)
+            block.order[pos[shards[l]]++] = l;
+        block.ids.assign(L, 0);
+        block.firsts.resize(L);
+    }
+
+    // find existing types and the first occurrences of new types in a shard
+    inline void merge_shard(Blocks &blocks, const MapTypes &map, std::size_t s,
+                            std::vector<Position> &news) {
+        MapFirst firsts;
+        for (std::size_t c = 0; c < blocks.size(); c++) {
+            Block &block = blocks[c];
+            for (std::size_t k = block.offsets[s]; k < block.offsets[s + 1]; k++) {
+                unsigned int l = block.order[k];
+                const Chars &type = block.types[l];
+                auto it1 = map.find(std::string(type.ptr, type.len));
+                if (it1 != map.end()) {
+                    block.ids[l] = it1->second;
+                    continue;
+                }
+                auto it2 = firsts.insert(std::make_pair(type, Position(c, l)));
+                if (it2.second)
+                    news.push_back(Position(c, l));
+                block.firsts[l] = it2.first->second;
+            }
+        }
+    }
+
+    // replace local IDs with global IDs
+    inline void remap_block(const Blocks &blocks, Texts &temp, Block &block) {
+        for (std::size_t l = 0; l < block.ids.size(); l++) {
+            if (block.ids[l] == 0) {
+                const Position &first = block.firsts[l];
+                block.ids[l] = blocks[first.first].ids[first.second];
+            }
+        }
+        for (std::size_t h = block.begin; h < block.end; h++) {
+            Text &text = temp[h];
+            for (std::size_t i = 0; i < text.size(); i++)
+                text[i] = block.ids[text[i] - 1];
+        }
+    }
+
+    /*
+     * Serialize H documents registering new types to map and types
+     * @param serialize_block function that converts the tokens of the documents
+     *   in a block to local IDs by local_id(); it is called in parallel, so it
+     *   must not use R's API
+     */
+    template <typename F>
+    Texts serialize_blocks(std::size_t H, F serialize_block,
+                           MapTypes &map, Types &types, const int thread) {
+
+        Texts temp(H);
+        if (H == 0)
+            return temp;
+
+#if QUANTEDA_USE_TBB
+        std::size_t T = thread > 0 ? thread : tbb::this_task_arena::max_concurrency();
+#else
+        std::size_t T = 1;
+#endif
+        std::size_t C = std::min(H, T * 4); // blocks
+        std::size_t P = C; // shards
+        Blocks blocks(C);
+        for (std::size_t c = 0; c < C; c++) {
+            blocks[c].begin = H * c / C;
+            blocks[c].end = H * (c + 1) / C;
+        }
+        std::vector< std::vector<Position> > news(P);
+
+#if QUANTEDA_USE_TBB
+        tbb::task_arena arena(thread);
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<int>(0, C), [&](tbb::blocked_range<int> r) {
+                for (int c = r.begin(); c < r.end(); ++c) {
+                    serialize_block(temp, blocks[c]);
+                    sort_block(blocks[c], P);
+                }
+            });
+            tbb::parallel_for(tbb::blocked_range<int>(0, P), [&](tbb::blocked_range<int> r) {
+                for (int s = r.begin(); s < r.end(); ++s) {
+                    merge_shard(blocks, map, s, news[s]);
+                }
+            });
+        });
+#else
+        for (std::size_t c = 0; c < C; c++) {
+            serialize_block(temp, blocks[c]);
+            sort_block(blocks[c], P);
+        }
+        for (std::size_t s = 0; s < P; s++) {
+            merge_shard(blocks, map, s, news[s]);
+        }
+#endif
+
+        std::vector<Position> firsts;
+        for (std::size_t s = 0; s < P; s++)
+            firsts.insert(firsts.end(), news[s].begin(), news[s].end());
+        std::sort(firsts.begin(), firsts.end());
+        types.reserve(types.size() + firsts.size());
+        for (const Position &first : firsts) {
+            Block &block = blocks[first.first];
+            const Chars &type_ = block.types[first.second];
+            std::string type(type_.ptr, type_.len);
+            types.push_back(type);
+            block.ids[first.second] = types.size();
+            map.insert(std::make_pair(type, types.size()));
+        }
+
+#if QUANTEDA_USE_TBB
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<int>(0, C), [&](tbb::blocked_range<int> r) {
+                for (int c = r.begin(); c < r.end(); ++c) {
+                    remap_block(blocks, temp, blocks[c]);
+                }
+            });
+        });
+#else
+        for (std::size_t c = 0; c < C; c++) {
+            remap_block(blocks, temp, blocks[c]);
+        }
+#endif
+        return temp;
+    }
+}
+
+#endif
@@ -18,13 +18,13 @@ inline unsigned int ngram_id(const Ngram &ngram,
     
 }
 
-inline void skip(const Text &tokens,
+inline void skip(const TextView &tokens,
                  Text &tokens_ng,
                  const SetNgrams &set_words,
                  const unsigned int &start,
                  const unsigned int &n, 
                  const std::vector<unsigned int> &skips,
-                 Ngram ngram,
+                 Ngram &ngram,
                  MapNgrams &map_ngram,
                  IdNgram &id_ngram) {
     
@@ -59,4 +59,5 @@ inline void skip(const Text &tokens,
             tokens_ng.push_back(ngram_id(ngram, map_ngram, id_ngram));
         }
     }
+    ngram.pop_back(); // reuse the buffer for the next ngram
 }
@@ -1,91 +1,953 @@
 #include <RcppArmadillo.h>
+#include <RcppParallel.h>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 // [[Rcpp::plugins(cpp11)]]
 using namespace Rcpp;
 
+#define CLANG_VERSION (__clang_major__ * 10000 + __clang_minor__ * 100 + __clang_patchlevel__)
+
+// compiler has to be newer than clang 3.30 or gcc 4.8.1
+#if RCPP_PARALLEL_USE_TBB && (CLANG_VERSION >= 30300 || GCC_VERSION >= 40801) 
+#define QUANTEDA_USE_TBB true // tbb.h is loaded automatically by RcppParallel.h
+#else
+#define QUANTEDA_USE_TBB false
+#endif
+
 typedef std::vector<unsigned int> Text;
 typedef std::vector<Text> Texts;
 typedef std::string Type;
 typedef std::vector<Type> Types;
 typedef std::vector<unsigned int> Ids;
+typedef std::vector<uint64_t> Offsets;
+typedef std::unordered_map<Type, unsigned int> MapTypes;
 
-class TokensObj {
+// Read-only view of a document in nested or flat storage; documents in
+// compact storage are decoded into a buffer owned by the view
+class TextView {
     public:
-        TokensObj(Texts texts_, Types types_, bool recompiled_ = false): 
-                  texts(texts_), types(types_), recompiled(recompiled_){}
+        TextView(): first(nullptr), last(nullptr), owned(false) {}
+        TextView(const unsigned int *first_, const unsigned int *last_):
+                 first(first_), last(last_), owned(false) {}
+        TextView(const Text &text_):
+                 first(text_.data()), last(text_.data() + text_.size()), owned(false) {}
+        TextView(Text &&text_): buffer(std::move(text_)), owned(true) { bind(); }
+        TextView(const TextView &view): buffer(view.buffer), owned(view.owned) {
+            copy(view);
+        }
+        TextView(TextView &&view): buffer(std::move(view.buffer)), owned(view.owned) {
+            copy(view);
+        }
+        TextView& operator=(const TextView &view) {
+            buffer = view.buffer;
+            owned = view.owned;
+            copy(view);
+            return *this;
+        }
+        TextView& operator=(TextView &&view) {
+            buffer = std::move(view.buffer);
+            owned = view.owned;
+            copy(view);
+            return *this;
+        }
+
+        const unsigned int* begin() const { return first; }
+        const unsigned int* end() const { return last; }
+        std::size_t size() const { return last - first; }
+        bool empty() const { return first == last; }
+        const unsigned int& operator[](std::size_t i) const { return first[i]; }
+        const unsigned int& back() const { return *(last - 1); }
+
+    private:
+        Text buffer;
+        const unsigned int *first;
+        const unsigned int *last;
+        bool owned;
+        void bind() {
+            first = buffer.data();
+            last = buffer.data() + buffer.size();
+        }
+        void copy(const TextView &view) {
+            if (owned) {
+                bind();
+            } else {
+                first = view.first;
+                last = view.last;
+            }
+        }
+};
+
+typedef std::vector<unsigned char> Bytes;
+
+// append token IDs as variable-length integers of 7 bits per byte
+inline void encode_ids(const unsigned int *first, const unsigned int *last, Bytes &bytes) {
+    for (const unsigned int *it = first; it != last; ++it) {
+        unsigned int id = *it;
+        while (id >= 0x80) {
+            bytes.push_back((unsigned char)(id | 0x80));
+            id >>= 7;
+        }
+        bytes.push_back((unsigned char)id);
+    }
+}
+
+// write token IDs encoded as above to out and return the end of the output
+inline unsigned char* encode_ids(const unsigned int *first, const unsigned int *last, 
+                                 unsigned char *out) {
+    for (const unsigned int *it = first; it != last; ++it) {
+        unsigned int id = *it;
+        while (id >= 0x80) {
+            *out++ = (unsigned char)(id | 0x80);
+            id >>= 7;
+        }
+        *out++ = (unsigned char)id;
+    }
+    return out;
+}
+
+// number of bytes required to encode token IDs
+inline std::size_t size_ids(const unsigned int *first, const unsigned int *last) {
+    std::size_t n = 0;
+    for (const unsigned int *it = first; it != last; ++it) {
+        unsigned int id = *it;
+        do {
+            n++;
+            id >>= 7;
+        } while (id > 0);
+    }
+    return n;
+}
+
+// decode token IDs encoded by encode_ids()
+inline Text decode_ids(const unsigned char *first, const unsigned char *last, std::size_t n) {
+    Text text;
+    text.reserve(n);
+    unsigned int id = 0, shift = 0;
+    for (const unsigned char *it = first; it != last; ++it) {
+        id |= (unsigned int)(*it & 0x7F) << shift;
+        if (*it & 0x80) {
+            shift += 7;
+        } else {
+            text.push_back(id);
+            id = 0;
+            shift = 0;
+        }
+    }
+    return text;
+}
+
+// unique number to identify a state of type tables
+inline uint64_t new_version() {
+    static std::atomic<uint64_t> count(0);
+    return ++count;
+}
+
+// hash and compare types by their values without copying them
+struct hash_type_ptr {
+    std::size_t operator() (const Type *type) const {
+        return std::hash<Type>()(*type);
+    }
+};
+
+struct equal_type_ptr {
+    bool operator() (const Type *type1, const Type *type2) const {
+        return *type1 == *type2;
+    }
+};
+
+typedef std::unordered_set<const Type*, hash_type_ptr, equal_type_ptr> SetTypePtrs;
+typedef std::unordered_map<const Type*, unsigned int, hash_type_ptr, equal_type_ptr> MapTypePtrs;
+
+// check if non-empty types are duplicated
+inline bool is_duplicated(const Types &types) {
+    SetTypePtrs types_unique;
+    types_unique.reserve(types.size());
+    for (const Type &type : types) {
+        if (type == "") continue;
+        if (!types_unique.insert(&type).second)
+            return true;
+    }
+    return false;
+}
+
+// flag IDs of types used in the documents given by text(h); each thread 
+// flags IDs separately and the flags are merged at the end
+template <typename TextFunc>
+inline std::vector<bool> flag_used(std::size_t H, std::size_t G, 
+                                   TextFunc text, const int thread) {
+    std::vector<bool> flags_used(G + 1, false);
+    std::atomic<bool> invalid(false);
+#if QUANTEDA_USE_TBB
+    tbb::enumerable_thread_specific< std::vector<bool> > flags_local(flags_used);
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
+            std::vector<bool> &flags = flags_local.local();
+            for (int h = r.begin(); h < r.end(); ++h) {
+                TextView text_h = text(h);
+                for (unsigned int id : text_h) {
+                    if (id > G) {
+                        invalid = true;
+                        return;
+                    }
+                    flags[id] = true;
+                }
+            }
+        });
+    });
+    for (const std::vector<bool> &flags : flags_local) {
+        for (std::size_t g = 0; g <= G; g++) {
+            if (flags[g])
+                flags_used[g] = true;
+        }
+    }
+#else
+    for (std::size_t h = 0; h < H && !invalid; h++) {
+        TextView text_h = text(h);
+        for (unsigned int id : text_h) {
+            if (id > G) {
+                invalid = true;
+                break;
+            }
+            flags_used[id] = true;
+        }
+    }
+#endif
+    if (invalid)
+        throw std::range_error("Invalid tokens object");
+    return flags_used;
+}
+
+// check if any of the documents given by text(h) has padding
+template <typename TextFunc>
+inline bool has_padding(std::size_t H, TextFunc text, const int thread) {
+    std::atomic<bool> padding(false);
+#if QUANTEDA_USE_TBB
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
+            for (int h = r.begin(); h < r.end() && !padding; ++h) {
+                TextView text_h = text(h);
+                if (std::find(text_h.begin(), text_h.end(), 0) != text_h.end())
+                    padding = true;
+            }
+        });
+    });
+#else
+    for (std::size_t h = 0; h < H && !padding; h++) {
+        TextView text_h = text(h);
+        if (std::find(text_h.begin(), text_h.end(), 0) != text_h.end())
+            padding = true;
+    }
+#endif
+    return padding;
+}
+
+// add the counts of token IDs in the documents given by text(h) for h in
+// [first, last) to counts; documents are divided into blocks of at least 2 * G
+// tokens, so local counts of blocks never take more memory than the token IDs
+// and small ranges are counted serially without allocation
+template <typename TextFunc, typename SizeFunc>
+inline void count_ids(std::size_t first, std::size_t last, std::size_t G,
+                      TextFunc text, SizeFunc ntoken,
+                      std::vector<uint64_t> &counts, const int thread) {
+    
+    std::atomic<bool> invalid(false);
+    auto count = [&](std::size_t begin, std::size_t end, std::vector<uint64_t> &counts_c) {
+        for (std::size_t h = begin; h < end && !invalid; h++) {
+            TextView text_h = text(h);
+            for (unsigned int id : text_h) {
+                if (id > G) {
+                    invalid = true;
+                    break;
+                }
+                counts_c[id]++;
+            }
+        }
+    };
+    
+    std::size_t C = 1;
+#if QUANTEDA_USE_TBB
+    uint64_t N = 0;
+    for (std::size_t h = first; h < last; h++)
+        N += ntoken(h);
+    std::size_t T = thread > 0 ? thread : tbb::this_task_arena::max_concurrency();
+    C = std::min((uint64_t)T, N / (2 * (G + 1)));
+#endif
+    if (C <= 1) {
+        count(first, last, counts);
+    } else {
+#if QUANTEDA_USE_TBB
+        // blocks of similar numbers of tokens
+        std::vector<std::size_t> offsets(1, first);
+        uint64_t n = 0;
+        for (std::size_t h = first; h < last; h++) {
+            n += ntoken(h);
+            if (n >= N * offsets.size() / C && offsets.size() < C)
+                offsets.push_back(h + 1);
+        }
+        offsets.push_back(last);
+        C = offsets.size() - 1;
         
+        // the first block is counted into counts
+        std::vector< std::vector<uint64_t> > counts_local(C - 1);
+        tbb::task_arena arena(thread);
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, C), [&](tbb::blocked_range<std::size_t> r) {
+                for (std::size_t c = r.begin(); c < r.end(); ++c) {
+                    if (c == 0) {
+                        count(offsets[c], offsets[c + 1], counts);
+                    } else {
+                        counts_local[c - 1].resize(G + 1, 0);
+                        count(offsets[c], offsets[c + 1], counts_local[c - 1]);
+                    }
+                }
+            });
+            // merge by ranges of types
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, G + 1), [&](tbb::blocked_range<std::size_t> r) {
+                for (const std::vector<uint64_t> &counts_c : counts_local) {
+                    for (std::size_t g = r.begin(); g < r.end(); ++g)
+                        counts[g] += counts_c[g];
+                }
+            });
+        });
+#endif
+    }
+    if (invalid)
+        throw std::range_error("Invalid tokens object");
+}
+
+// convert types to a character vector in UTF-8 without temporary strings
+inline CharacterVector encode_types(const Types &types) {
+    CharacterVector types_(types.size());
+    for (std::size_t i = 0; i < types.size(); i++)
+        SET_STRING_ELT(types_, i, Rf_mkCharLenCE(types[i].data(), types[i].size(), CE_UTF8));
+    return types_;
+}
+
+// defined in altrep.h
+inline CharacterVector lazy_types(std::shared_ptr<const Types> types);
+
+typedef std::pair<uint64_t, uint64_t> Range;
+typedef std::vector<Range> Ranges;
+typedef std::shared_ptr<Text> TextPtr;
+typedef std::vector<TextPtr> TextPtrs;
+
+// Documents, types and counts of token IDs are reference-counted and shared 
+// between copies of an object until one of them modifies them (copy-on-write)
+// Only the documents replaced or added after the last recompile() are 
+// scanned in the next call; other documents are summarized in counts
+class TokensObj {
+    public:
+        TokensObj(Texts texts_, Types types_, bool recompiled_ = false):
+                  recompiled(recompiled_), flat(false), compact(false),
+                  types(std::make_shared<Types>(std::move(types_))),
+                  version(new_version()), version_encoded(0), 
+                  version_dictionary(0), clean(0) {
+            add_texts(std::move(texts_));
+        }
+
         // variables
-        Texts texts;
-        Types types;
         bool recompiled;
-        
+        bool flat;
+        bool compact; // flat storage of encoded token IDs
+
         // functions
-        void recompile();
+        std::size_t size() const;
+        std::size_t ntoken(std::size_t h) const;
+        TextView text(std::size_t h) const;
+        unsigned int* begin(std::size_t h);
+        unsigned int* end(std::size_t h);
+        void set_texts(Texts &&texts_);
+        void add_texts(Texts &&texts_);
+        void release(std::size_t h);
+        template <typename Func>
+        void transform(Func func, const int thread = 1);
+        void set_flat(bool flat_);
+        void set_compact(bool compact_);
+        void set_ids(Ids &&ids_, Ranges &&ranges_);
+        void set_buffer(std::shared_ptr<const unsigned int> buffer_, Ranges &&ranges_);
+        void set_bytes(Bytes &&bytes_, Ranges &&ranges_, std::vector<unsigned int> &&lengths_);
+        TokensObj subset(const std::vector<std::size_t> &index) const;
+        void unshare();
+        const Types& get_types() const;
+        CharacterVector encoded_types();
+        Types& mutable_types();
+        MapTypes& get_dictionary();
+        void drop_dictionary();
+        Types& append_types();
+        void set_types(Types &&types_);
+        void share_types(const TokensObj &obj);
+        uint64_t types_version() const;
+        void recompile(const int thread = 1);
 
     private:
-        bool is_duplicated(Types types);
+        std::shared_ptr<Types> types;
+        uint64_t version; // changes when types are modified
+        CharacterVector types_encoded; // cache of types for R
+        uint64_t version_encoded; // version of the cached types
+        std::shared_ptr<MapTypes> dictionary; // IDs of types for serialization
+        uint64_t version_dictionary; // version of types in the dictionary
+        TextPtrs docs; // nested storage
+        std::shared_ptr<Ids> ids; // flat storage: token IDs of all the documents
+        std::shared_ptr<const unsigned int> buffer; // flat storage: read-only token IDs 
+        Ranges ranges; // flat storage: positions of documents in ids or bytes
+        std::shared_ptr<Bytes> bytes; // compact storage: encoded token IDs
+        std::vector<unsigned int> lengths; // compact storage: number of tokens
+        std::shared_ptr< std::vector<uint64_t> > counts; // frequency of token IDs in clean documents
+        std::size_t clean; // documents before this are counted in recompile()
+        const unsigned int* data() const;
+        void clear();
+        void erase_texts();
+        template <typename T, typename Func>
+        void transform_flat(std::shared_ptr< std::vector<T> > &store, Func func, 
+                            const int thread);
+        void repack(bool flat_, bool compact_);
 };
 
-inline bool TokensObj::is_duplicated(Types types) {
-    std::sort(types.begin(), types.end());
-    if (types.size() <= 1) return false;
-    for (std::size_t i = 0; i < types.size() - 1; i++) {
-        if (types[i] != "" && types[i] == types[i + 1]) {
-            return true;
+// number of documents
+inline std::size_t TokensObj::size() const {
+    if (flat)
+        return ranges.size();
+    return docs.size();
+}
+
+// number of tokens in a document
+inline std::size_t TokensObj::ntoken(std::size_t h) const {
+    if (compact)
+        return lengths[h];
+    if (flat)
+        return ranges[h].second - ranges[h].first;
+    return docs[h] ? docs[h]->size() : 0;
+}
+
+// token IDs in flat storage
+inline const unsigned int* TokensObj::data() const {
+    if (buffer)
+        return buffer.get();
+    return ids->data();
+}
+
+inline TextView TokensObj::text(std::size_t h) const {
+    if (compact)
+        return TextView(decode_ids(bytes->data() + ranges[h].first, 
+                                   bytes->data() + ranges[h].second, lengths[h]));
+    if (flat)
+        return TextView(data() + ranges[h].first, data() + ranges[h].second);
+    if (!docs[h])
+        return TextView(); // released
+    return TextView(*docs[h]);
+}
+
+// only for objects that are not shared and not compact; call unshare() before
+inline unsigned int* TokensObj::begin(std::size_t h) {
+    if (flat)
+        return ids->data() + ranges[h].first;
+    return docs[h]->data();
+}
+
+inline unsigned int* TokensObj::end(std::size_t h) {
+    if (flat)
+        return ids->data() + ranges[h].second;
+    return docs[h]->data() + docs[h]->size();
+}
+
+// replace all the documents keeping the storage mode
+inline void TokensObj::set_texts(Texts &&texts_) {
+    clean = 0;
+    counts.reset();
+    clear();
+    add_texts(std::move(texts_));
+}
+
+// remove all the documents
+inline void TokensObj::clear() {
+    TextPtrs().swap(docs);
+    ids.reset();
+    buffer.reset();
+    bytes.reset();
+    Ranges().swap(ranges);
+    std::vector<unsigned int>().swap(lengths);
+}
+
+// free a document that is already processed in nested storage; the
+// document is only released from this object when it is shared
+inline void TokensObj::release(std::size_t h) {
+    if (!flat)
+        docs[h].reset();
+}
+
+// make all the documents empty without allocating memory
+inline void TokensObj::erase_texts() {
+    recompiled = false;
+    clean = 0;
+    counts.reset();
+    if (flat) {
+        std::fill(ranges.begin(), ranges.end(), Range(0, 0));
+        std::fill(lengths.begin(), lengths.end(), 0);
+    } else {
+        for (std::size_t h = 0; h < docs.size(); h++)
+            docs[h].reset();
+    }
+}
+
+// replace each document by func(h), which is called in parallel and must read
+// documents only by text(h); results are written back as soon as they are 
+// produced, so the documents are not copied in any storage mode. All the
+// documents become empty if func throws, because some are already replaced.
+template <typename Func>
+inline void TokensObj::transform(Func func, const int thread) {
+    clean = 0;
+    counts.reset();
+    try {
+        if (compact) {
+            transform_flat(bytes, [&](std::size_t h, Bytes &temp) -> std::size_t {
+                Text text = func(h);
+                encode_ids(text.data(), text.data() + text.size(), temp);
+                return text.size();
+            }, thread);
+        } else if (flat) {
+            transform_flat(ids, [&](std::size_t h, Ids &temp) -> std::size_t {
+                temp = func(h);
+                return temp.size();
+            }, thread);
+        } else {
+            // documents shared with other objects are only released
+            std::size_t H = docs.size();
+#if QUANTEDA_USE_TBB
+            tbb::task_arena arena(thread);
+            arena.execute([&]{
+                tbb::parallel_for(tbb::blocked_range<std::size_t>(0, H), [&](tbb::blocked_range<std::size_t> r) {
+                    for (std::size_t h = r.begin(); h < r.end(); ++h)
+                        docs[h] = std::make_shared<Text>(func(h));
+                });
+            });
+#else
+            for (std::size_t h = 0; h < H; h++)
+                docs[h] = std::make_shared<Text>(func(h));
+#endif
         }
+    } catch (...) {
+        erase_texts();
+        throw;
     }
-    return false;
 }
 
-inline void TokensObj::recompile() {
+// transform documents in flat or compact storage by blocks; func(h, temp) 
+// writes the result to temp and returns the number of tokens. The results of
+// a block are written over the documents already processed if the storage is
+// not shared and the documents are in order; they are appended to the end only
+// if they do not fit, so memory is needed only for a block of documents.
+// Otherwise, the results are written to new storage leaving the source intact.
+template <typename T, typename Func>
+inline void TokensObj::transform_flat(std::shared_ptr< std::vector<T> > &store, 
+                                      Func func, const int thread) {
+    std::size_t H = ranges.size();
+    bool inplace = !buffer && store && store.use_count() == 1;
+    uint64_t total = 0;
+    for (std::size_t h = 0; h < H; h++) {
+        if (h > 0 && ranges[h - 1].second > ranges[h].first)
+            inplace = false;
+        total += ranges[h].second - ranges[h].first;
+    }
+    std::shared_ptr< std::vector<T> > store_new = inplace ? store : std::make_shared< std::vector<T> >();
+    uint64_t end = store_new->size(); // results that do not fit are appended after this
+    uint64_t pos = 0; // position to write the next result in place
+
+    std::size_t nthread = 1;
+#if QUANTEDA_USE_TBB
+    nthread = thread > 0 ? thread : tbb::this_task_arena::max_concurrency();
+    tbb::task_arena arena(thread);
+#endif
+    // blocks of 1/64 of the storage but at least a document for each thread
+    uint64_t size_block = std::max(total / 64, (uint64_t)1 << 20);
+    std::size_t first = 0;
+    while (first < H) {
+        std::size_t last = first;
+        uint64_t n = 0;
+        while (last < H && (n < size_block || last - first < nthread)) {
+            n += ranges[last].second - ranges[last].first;
+            last++;
+        }
+        std::vector< std::vector<T> > temp(last - first);
+        std::vector<std::size_t> sizes(last - first);
+#if QUANTEDA_USE_TBB
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(first, last), [&](tbb::blocked_range<std::size_t> r) {
+                for (std::size_t h = r.begin(); h < r.end(); ++h)
+                    sizes[h - first] = func(h, temp[h - first]);
+            });
+        });
+#else
+        for (std::size_t h = first; h < last; h++)
+            sizes[h - first] = func(h, temp[h - first]);
+#endif
+        // documents before this are already processed
+        uint64_t limit = last < H ? ranges[last].first : end;
+        for (std::size_t h = first; h < last; h++) {
+            std::vector<T> &temp_h = temp[h - first];
+            if (inplace && pos + temp_h.size() <= limit) {
+                std::copy(temp_h.begin(), temp_h.end(), store_new->begin() + pos);
+                ranges[h] = Range(pos, pos + temp_h.size());
+                pos += temp_h.size();
+            } else {
+                uint64_t first_h = store_new->size();
+                store_new->insert(store_new->end(), temp_h.begin(), temp_h.end());
+                ranges[h] = Range(first_h, store_new->size());
+            }
+            if (compact)
+                lengths[h] = sizes[h - first];
+            std::vector<T>().swap(temp_h);
+        }
+        first = last;
+    }
+
+    if (inplace) {
+        // move the appended results next to the others
+        uint64_t shift = end - pos;
+        if (shift > 0) {
+            std::copy(store->begin() + end, store->end(), store->begin() + pos);
+            for (std::size_t h = 0; h < H; h++) {
+                if (ranges[h].first >= end)
+                    ranges[h] = Range(ranges[h].first - shift, ranges[h].second - shift);
+            }
+            store->resize(store->size() - shift);
+        }
+    } else {
+        store = store_new;
+        buffer.reset();
+    }
+}
+
+// append documents keeping the storage mode
+inline void TokensObj::add_texts(Texts &&texts_) {
+    if (compact) {
+        unshare();
+        if (!bytes)
+            bytes = std::make_shared<Bytes>();
+        std::size_t n = bytes->size();
+        for (std::size_t h = 0; h < texts_.size(); h++)
+            n += size_ids(texts_[h].data(), texts_[h].data() + texts_[h].size());
+        bytes->reserve(n);
+        ranges.reserve(ranges.size() + texts_.size());
+        lengths.reserve(lengths.size() + texts_.size());
+        for (std::size_t h = 0; h < texts_.size(); h++) {
+            uint64_t first = bytes->size();
+            encode_ids(texts_[h].data(), texts_[h].data() + texts_[h].size(), *bytes);
+            ranges.push_back(Range(first, bytes->size()));
+            lengths.push_back(texts_[h].size());
+            Text().swap(texts_[h]); // release memory as early as possible
+        }
+    } else if (flat) {
+        unshare();
+        if (!ids)
+            ids = std::make_shared<Ids>();
+        std::size_t n = ids->size();
+        for (std::size_t h = 0; h < texts_.size(); h++)
+            n += texts_[h].size();
+        ids->reserve(n);
+        ranges.reserve(ranges.size() + texts_.size());
+        for (std::size_t h = 0; h < texts_.size(); h++) {
+            uint64_t first = ids->size();
+            ids->insert(ids->end(), texts_[h].begin(), texts_[h].end());
+            ranges.push_back(Range(first, ids->size()));
+            Text().swap(texts_[h]); // release memory as early as possible
+        }
+    } else {
+        docs.reserve(docs.size() + texts_.size());
+        for (std::size_t h = 0; h < texts_.size(); h++)
+            docs.push_back(std::make_shared<Text>(std::move(texts_[h])));
+    }
+}
 
-    Ids ids_new(types.size() + 1);
+inline void TokensObj::set_flat(bool flat_) {
+    if (flat_ != flat)
+        repack(flat_, false);
+}
+
+// use token IDs of all the documents as flat storage without copying them
+inline void TokensObj::set_ids(Ids &&ids_, Ranges &&ranges_) {
+    clear();
+    clean = 0;
+    counts.reset();
+    flat = true;
+    compact = false;
+    ids = std::make_shared<Ids>(std::move(ids_));
+    ranges = std::move(ranges_);
+}
+
+// use token IDs in a read-only buffer such as a memory-mapped file as flat 
+// storage; they are copied when the documents are modified
+inline void TokensObj::set_buffer(std::shared_ptr<const unsigned int> buffer_, 
+                                  Ranges &&ranges_) {
+    clear();
+    clean = 0;
+    counts.reset();
+    flat = true;
+    compact = false;
+    buffer = buffer_;
+    ranges = std::move(ranges_);
+}
+
+// use encoded token IDs of all the documents as compact storage without 
+// copying them
+inline void TokensObj::set_bytes(Bytes &&bytes_, Ranges &&ranges_, 
+                                 std::vector<unsigned int> &&lengths_) {
+    clear();
+    clean = 0;
+    counts.reset();
+    flat = true;
+    compact = true;
+    bytes = std::make_shared<Bytes>(std::move(bytes_));
+    ranges = std::move(ranges_);
+    lengths = std::move(lengths_);
+}
+
+// compact storage is also flat storage
+inline void TokensObj::set_compact(bool compact_) {
+    if (compact_ != compact)
+        repack(flat || compact_, compact_);
+}
+
+// select documents sharing their token IDs and types with this object
+inline TokensObj TokensObj::subset(const std::vector<std::size_t> &index) const {
+    TokensObj obj(Texts(), Types(), recompiled);
+    obj.types = types;
+    obj.version = version;
+    obj.types_encoded = types_encoded;
+    obj.version_encoded = version_encoded;
+    obj.dictionary = dictionary;
+    obj.version_dictionary = version_dictionary;
+    obj.flat = flat;
+    obj.compact = compact;
+    if (flat) {
+        obj.ids = ids;
+        obj.buffer = buffer;
+        obj.bytes = bytes;
+        obj.ranges.reserve(index.size());
+        for (std::size_t i = 0; i < index.size(); i++)
+            obj.ranges.push_back(ranges[index[i]]);
+        if (compact) {
+            obj.lengths.reserve(index.size());
+            for (std::size_t i = 0; i < index.size(); i++)
+                obj.lengths.push_back(lengths[index[i]]);
+        }
+    } else {
+        obj.docs.reserve(index.size());
+        for (std::size_t i = 0; i < index.size(); i++)
+            obj.docs.push_back(docs[index[i]]);
+    }
+    return obj;
+}
+
+// copy documents shared with other objects before modifying them
+inline void TokensObj::unshare() {
+    if (compact) {
+        if (!bytes || bytes.use_count() == 1)
+            return;
+        std::size_t n = 0;
+        for (std::size_t h = 0; h < ranges.size(); h++)
+            n += ranges[h].second - ranges[h].first;
+        std::shared_ptr<Bytes> bytes_new = std::make_shared<Bytes>();
+        bytes_new->reserve(n);
+        for (std::size_t h = 0; h < ranges.size(); h++) {
+            uint64_t first = bytes_new->size();
+            bytes_new->insert(bytes_new->end(), bytes->begin() + ranges[h].first, 
+                              bytes->begin() + ranges[h].second);
+            ranges[h] = Range(first, bytes_new->size());
+        }
+        bytes = bytes_new;
+    } else if (flat) {
+        if (!buffer && (!ids || ids.use_count() == 1))
+            return;
+        std::size_t n = 0;
+        for (std::size_t h = 0; h < ranges.size(); h++)
+            n += ranges[h].second - ranges[h].first;
+        std::shared_ptr<Ids> ids_new = std::make_shared<Ids>();
+        ids_new->reserve(n);
+        for (std::size_t h = 0; h < ranges.size(); h++) {
+            uint64_t first = ids_new->size();
+            ids_new->insert(ids_new->end(), data() + ranges[h].first, 
+                            data() + ranges[h].second);
+            ranges[h] = Range(first, ids_new->size());
+        }
+        ids = ids_new;
+        buffer.reset(); // read-only token IDs are copied
+    } else {
+        for (std::size_t h = 0; h < docs.size(); h++) {
+            if (!docs[h]) {
+                docs[h] = std::make_shared<Text>();
+            } else if (docs[h].use_count() > 1) {
+                docs[h] = std::make_shared<Text>(*docs[h]);
+            }
+        }
+    }
+}
+
+inline const Types& TokensObj::get_types() const {
+    return *types;
+}
+
+// types as a character vector; it is created again only if types are modified
+// and its elements are converted only when they are used in R
+inline CharacterVector TokensObj::encoded_types() {
+    if (version_encoded != version) {
+        types_encoded = lazy_types(types);
+        MARK_NOT_MUTABLE(types_encoded); // returned to R many times
+        version_encoded = version;
+    }
+    return types_encoded;
+}
+
+// copy types shared with other objects before modifying them
+inline Types& TokensObj::mutable_types() {
+    types_encoded = CharacterVector(); // the cache shares the types
+    version_encoded = 0;
+    dictionary.reset();
+    if (types.use_count() > 1)
+        types = std::make_shared<Types>(*types);
+    version = new_version();
+    return *types;
+}
+
+inline void TokensObj::set_types(Types &&types_) {
+    dictionary.reset();
+    types = std::make_shared<Types>(std::move(types_));
+    version = new_version();
+}
+
+// IDs of types to register new types in serialization; it is kept while
+// types are only appended by append_types(); it holds another copy of all the
+// types, so it must be dropped by drop_dictionary() after serialization
+inline MapTypes& TokensObj::get_dictionary() {
+    if (!dictionary || version_dictionary != version) {
+        dictionary = std::make_shared<MapTypes>();
+        dictionary->reserve(types->size());
+        for (std::size_t g = 0; g < types->size(); g++)
+            dictionary->insert(std::make_pair((*types)[g], g + 1));
+        version_dictionary = version;
+    } else if (dictionary.use_count() > 1) {
+        dictionary = std::make_shared<MapTypes>(*dictionary);
+    }
+    return *dictionary;
+}
+
+inline void TokensObj::drop_dictionary() {
+    dictionary.reset();
+    version_dictionary = 0;
+}
+
+// types to which new types are appended; they must also be registered to 
+// the dictionary obtained by get_dictionary() before this
+inline Types& TokensObj::append_types() {
+    bool valid = dictionary && version_dictionary == version;
+    types_encoded = CharacterVector();
+    version_encoded = 0;
+    if (types.use_count() > 1)
+        types = std::make_shared<Types>(*types);
+    version = new_version();
+    if (valid)
+        version_dictionary = version;
+    return *types;
+}
+
+// use the same types as another object
+inline void TokensObj::share_types(const TokensObj &obj) {
+    types = obj.types;
+    version = obj.version;
+    types_encoded = obj.types_encoded;
+    version_encoded = obj.version_encoded;
+    dictionary = obj.dictionary;
+    version_dictionary = obj.version_dictionary;
+}
+
+inline uint64_t TokensObj::types_version() const {
+    return version;
+}
+
+// convert the storage mode without changing documents
+inline void TokensObj::repack(bool flat_, bool compact_) {
+    std::size_t H = size();
+    Texts temp(H);
+    for (std::size_t h = 0; h < H; h++) {
+        TextView text_h = text(h);
+        temp[h] = Text(text_h.begin(), text_h.end());
+        release(h);
+    }
+    clear();
+    flat = flat_;
+    compact = compact_;
+    add_texts(std::move(temp)); // counts are still valid
+}
+
+inline void TokensObj::recompile(const int thread) {
+
+    drop_dictionary(); // types are not appended after recompile
+    const Types &types = get_types();
+    std::size_t G = types.size();
+    std::size_t H = size();
+
+    // Nothing has changed since the last call
+    if (recompiled && clean == H)
+        return;
+
+    /// dev::Timer timer;
+
+    // Count IDs only in documents changed after the last call
+    // dev::start_timer("Count IDs", timer);
+    if (!counts || counts->size() > G + 1) {
+        clean = 0; // types are replaced
+        counts = std::make_shared< std::vector<uint64_t> >();
+    } else if (counts.use_count() > 1) {
+        counts = std::make_shared< std::vector<uint64_t> >(*counts); // shared with copies
+    }
+    counts->resize(G + 1, 0);
+    if (clean < H) {
+        try {
+            count_ids(clean, H, G, [&](std::size_t h) { return text(h); },
+                      [&](std::size_t h) { return ntoken(h); }, *counts, thread);
+        } catch (...) {
+            clean = 0; // counts are partially updated
+            counts.reset();
+            throw;
+        }
+        clean = H;
+    }
+    // dev::stop_timer("Count IDs", timer);
+
+    Ids ids_new(G + 1);
     ids_new[0] = 0; // reserved for padding
     unsigned int id_new = 1;
-    std::vector<bool> flags_used(ids_new.size(), false);
-    std::vector<bool> flags_unique(ids_new.size(), false);
+    std::vector<bool> flags_used(G + 1, false);
+    std::vector<bool> flags_unique(G + 1, false);
 
-    /// dev::Timer timer;
-  
     // Check if all IDs are used
     bool all_used;
+    const std::vector<uint64_t> &counts_old = *counts;
+    flags_used[0] = counts_old[0] > 0;
     if (!recompiled) {
-        // dev::start_timer("Check gaps", timer);
-        unsigned int id_limit = ids_new.size();
-        for (std::size_t h = 0; h < texts.size(); h++) {
-            for (std::size_t i = 0; i < texts[h].size(); i++) {
-                unsigned int id = texts[h][i];
-                if (id > id_limit) {
-                    throw std::range_error("Invalid tokens object");
-                }
-                flags_used[id] = true;
-            }
-        }
-        all_used = std::all_of(flags_used.begin(), flags_used.end(), [](bool v) { return v; });
-        // dev::stop_timer("Check gaps", timer);
+        for (std::size_t g = 1; g <= G; g++)
+            flags_used[g] = counts_old[g] > 0;
+        all_used = std::all_of(flags_used.begin() + 1, flags_used.end(), [](bool v) { return v; });
     } else {
         // Mark all types but padding are used
         std::fill(flags_used.begin() + 1, flags_used.end(), true);
-        
-        // Only check for padding
-        for (std::size_t h = 0; h < texts.size() && !flags_used[0]; h++) {
-            for (std::size_t i = 0; i < texts[h].size() && !flags_used[0]; i++) {
-                if (texts[h][i] == 0) {
-                    flags_used[0] = true;
-                }
-            }
-        }
         all_used = true;
     }
-    
+
     // Check if types are duplicated
     bool all_unique;
     if (!recompiled && is_duplicated(types)) {
-        std::unordered_map<std::string, unsigned int> types_unique;
+        MapTypePtrs types_unique;
+        types_unique.reserve(G);
         flags_unique[0] = true; // padding is always unique
         for (std::size_t g = 1; g < ids_new.size(); g++) {
             if (types[g - 1] == "") continue; // ignore null types
             if (!flags_used[g]) continue; // ignore unused
-            auto it = types_unique.insert(std::pair<std::string, unsigned int>(types[g - 1], id_new));
+            auto it = types_unique.insert(std::make_pair(&types[g - 1], id_new));
             ids_new[g] = it.first->second;
             if (it.second) {
                 flags_unique[g] = true;
@@ -94,7 +956,6 @@ inline void TokensObj::recompile() {
         }
         all_unique = std::all_of(flags_unique.begin(), flags_unique.end(), [](bool v) { return v; });
     } else {
-        unsigned int id_new = 1;
         for (std::size_t g = 1; g < ids_new.size(); g++) {
             if (flags_used[g]) {
                 ids_new[g] = id_new++;
@@ -103,18 +964,65 @@ inline void TokensObj::recompile() {
         std::fill(flags_unique.begin(), flags_unique.end(), true);
         all_unique = true;
     }
-    
+
     // Do nothing if all used and unique
     if (all_used && all_unique) {
         recompiled = true;
         return;
     }
 
-    for (std::size_t h = 0; h < texts.size(); h++) {
-        for (std::size_t i = 0; i < texts[h].size(); i++) {
-            texts[h][i] = ids_new[texts[h][i]];
-            //Rcout << texts[h][i] << " -> " << ids_new[texts[h][i]] << "\n";
+    if (compact) {
+        // decode, remap and encode each document
+        std::vector<Bytes> temp(H);
+        auto remap = [&](std::size_t h) {
+            TextView text_h = text(h);
+            Text text_new(text_h.size());
+            for (std::size_t i = 0; i < text_h.size(); i++)
+                text_new[i] = ids_new[text_h[i]];
+            encode_ids(text_new.data(), text_new.data() + text_new.size(), temp[h]);
+        };
+#if QUANTEDA_USE_TBB
+        tbb::task_arena arena(thread);
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
+                for (int h = r.begin(); h < r.end(); ++h)
+                    remap(h);
+            });
+        });
+#else
+        for (std::size_t h = 0; h < H; h++)
+            remap(h);
+#endif
+        std::size_t n = 0;
+        for (std::size_t h = 0; h < H; h++)
+            n += temp[h].size();
+        std::shared_ptr<Bytes> bytes_new = std::make_shared<Bytes>();
+        bytes_new->reserve(n);
+        for (std::size_t h = 0; h < H; h++) {
+            uint64_t first = bytes_new->size();
+            bytes_new->insert(bytes_new->end(), temp[h].begin(), temp[h].end());
+            ranges[h] = Range(first, bytes_new->size());
+            Bytes().swap(temp[h]);
+        }
+        bytes = bytes_new;
+    } else {
+        unshare();
+#if QUANTEDA_USE_TBB
+        tbb::task_arena arena(thread);
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
+                for (int h = r.begin(); h < r.end(); ++h) {
+                    for (unsigned int *it = begin(h), *last = end(h); it != last; ++it)
+                        *it = ids_new[*it];
+                }
+            });
+        });
+#else
+        for (std::size_t h = 0; h < H; h++) {
+            for (unsigned int *it = begin(h), *last = end(h); it != last; ++it)
+                *it = ids_new[*it];
         }
+#endif
     }
 
     Types types_new;
@@ -124,9 +1032,14 @@ inline void TokensObj::recompile() {
             types_new.push_back(types[j]);
         }
     }
-    types = types_new;
+    std::shared_ptr< std::vector<uint64_t> > counts_new = 
+        std::make_shared< std::vector<uint64_t> >(types_new.size() + 1, 0);
+    for (std::size_t g = 0; g < ids_new.size(); g++)
+        (*counts_new)[ids_new[g]] += counts_old[g];
+    counts = counts_new;
+    set_types(std::move(types_new));
     recompiled = true;
     return;
 }
 
-
+#include "altrep.h"
@@ -0,0 +1,257 @@
+#ifndef QUANTEDA_UTF8 // prevent redefining
+#define QUANTEDA_UTF8
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define QUANTEDA_USE_SSE2 1
+#else
+#define QUANTEDA_USE_SSE2 0
+#endif
+
+/*
+ * UTF-8 functions on bytes
+ * Strings are scanned 16 bytes at a time with SSE2, which is available on all
+ * the x86-64 CPUs, or 8 bytes at a time in 64-bit integers on other CPUs.
+ * Code points are counted as bytes that are not continuation bytes (10xxxxxx),
+ * so invalid sequences are counted consistently without being decoded.
+ */
+
+inline int utf8_popcount(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1)
+        n++;
+    return n;
+#endif
+}
+
+inline int utf8_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    return utf8_popcount((uint32_t)x) + utf8_popcount((uint32_t)(x >> 32));
+#endif
+}
+
+inline bool utf8_is_lead(char c) {
+    return (c & 0xC0) != 0x80;
+}
+
+// number of code points in 16 or 8 bytes
+#if QUANTEDA_USE_SSE2
+const std::size_t UTF8_BLOCK = 16;
+inline std::size_t utf8_count_block(const char *str) {
+    __m128i v = _mm_loadu_si128((const __m128i*)str);
+    // continuation bytes are -128 to -65 as signed
+    __m128i lead = _mm_cmpgt_epi8(v, _mm_set1_epi8(-65));
+    return utf8_popcount(_mm_movemask_epi8(lead));
+}
+inline bool utf8_is_ascii_block(const char *str) {
+    __m128i v = _mm_loadu_si128((const __m128i*)str);
+    return _mm_movemask_epi8(v) == 0;
+}
+#else
+const std::size_t UTF8_BLOCK = 8;
+inline std::size_t utf8_count_block(const char *str) {
+    uint64_t v;
+    std::memcpy(&v, str, 8);
+    // the highest bit is set and the second highest bit is not set
+    uint64_t cont = v & ~(v << 1) & 0x8080808080808080ULL;
+    return 8 - utf8_popcount64(cont);
+}
+inline bool utf8_is_ascii_block(const char *str) {
+    uint64_t v;
+    std::memcpy(&v, str, 8);
+    return (v & 0x8080808080808080ULL) == 0;
+}
+#endif
+
+// number of leading bytes that are printable ASCII characters (! to ~)
+inline std::size_t utf8_ascii_graph(const char *str, std::size_t len) {
+    std::size_t i = 0;
+#if QUANTEDA_USE_SSE2
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+        // bytes of non-ASCII characters are negative as signed
+        __m128i graph = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x20)),
+                                      _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+        int mask = _mm_movemask_epi8(graph);
+        if (mask != 0xFFFF)
+            break;
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, str + i, 8);
+        const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+        uint64_t less = (v - ones * 0x21) & ~v & highs; // bytes below !
+        uint64_t more = ((v + ones * (127 - 0x7E)) | v) & highs; // bytes above ~
+        if (less | more)
+            break;
+    }
+#endif
+    while (i < len && 0x20 < (unsigned char)str[i] && (unsigned char)str[i] < 0x7F)
+        i++;
+    return i;
+}
+
+inline bool utf8_is_ascii(const char *str, std::size_t len) {
+    std::size_t i = 0;
+    for (; i + UTF8_BLOCK <= len; i += UTF8_BLOCK) {
+        if (!utf8_is_ascii_block(str + i))
+            return false;
+    }
+    for (; i < len; i++) {
+        if ((unsigned char)str[i] >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+// number of code points
+inline std::size_t utf8_count(const char *str, std::size_t len) {
+    std::size_t n = 0, i = 0;
+    for (; i + UTF8_BLOCK <= len; i += UTF8_BLOCK)
+        n += utf8_count_block(str + i);
+    for (; i < len; i++)
+        n += utf8_is_lead(str[i]);
+    return n;
+}
+
+// number of bytes of the first n code points
+inline std::size_t utf8_left(const char *str, std::size_t len, std::size_t n) {
+    std::size_t m = 0, i = 0; // code points before i
+    for (; i + UTF8_BLOCK <= len; i += UTF8_BLOCK) {
+        std::size_t k = utf8_count_block(str + i);
+        if (m + k > n)
+            break;
+        m += k;
+    }
+    for (; i < len; i++) {
+        if (utf8_is_lead(str[i])) {
+            if (m == n)
+                return i;
+            m++;
+        }
+    }
+    return len;
+}
+
+// position of the last n code points in bytes
+inline std::size_t utf8_right(const char *str, std::size_t len, std::size_t n) {
+    if (n == 0)
+        return len;
+    std::size_t m = 0, i = len; // code points after i
+    for (; i >= UTF8_BLOCK; i -= UTF8_BLOCK) {
+        std::size_t k = utf8_count_block(str + i - UTF8_BLOCK);
+        if (m + k >= n)
+            break;
+        m += k;
+    }
+    while (i > 0) {
+        i--;
+        if (utf8_is_lead(str[i])) {
+            if (++m == n)
+                return i;
+        }
+    }
+    return 0;
+}
+
+// decode a UTF-8 character at the beginning of str and set its length to n;
+// invalid bytes are returned one by one as U+FFFD
+inline uint32_t utf8_decode(const char *str, std::size_t len, std::size_t &n) {
+    const unsigned char *s = (const unsigned char*)str;
+    uint32_t c = s[0];
+    n = 1;
+    if (c < 0x80)
+        return c;
+    std::size_t m;
+    uint32_t min;
+    if ((c & 0xE0) == 0xC0) {
+        m = 2; min = 0x80; c &= 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        m = 3; min = 0x800; c &= 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+        m = 4; min = 0x10000; c &= 0x07;
+    } else {
+        return 0xFFFD;
+    }
+    if (m > len)
+        return 0xFFFD;
+    for (std::size_t k = 1; k < m; k++) {
+        if ((s[k] & 0xC0) != 0x80)
+            return 0xFFFD;
+        c = (c << 6) | (s[k] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF || (0xD800 <= c && c <= 0xDFFF))
+        return 0xFFFD;
+    n = m;
+    return c;
+}
+
+// append a code point to str in UTF-8
+inline void utf8_encode(uint32_t c, std::string &str) {
+    if (c < 0x80) {
+        str.push_back(c);
+    } else if (c < 0x800) {
+        str.push_back(0xC0 | (c >> 6));
+        str.push_back(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        str.push_back(0xE0 | (c >> 12));
+        str.push_back(0x80 | ((c >> 6) & 0x3F));
+        str.push_back(0x80 | (c & 0x3F));
+    } else {
+        str.push_back(0xF0 | (c >> 18));
+        str.push_back(0x80 | ((c >> 12) & 0x3F));
+        str.push_back(0x80 | ((c >> 6) & 0x3F));
+        str.push_back(0x80 | (c & 0x3F));
+    }
+}
+
+// check if str is valid UTF-8 without overlong forms and surrogates
+inline bool utf8_valid(const char *str, std::size_t len) {
+    std::size_t i = 0;
+    while (i < len) {
+        if (i + UTF8_BLOCK <= len && utf8_is_ascii_block(str + i)) {
+            i += UTF8_BLOCK;
+            continue;
+        }
+        if ((unsigned char)str[i] < 0x80) {
+            i++;
+            continue;
+        }
+        std::size_t n;
+        if (utf8_decode(str + i, len - i, n) == 0xFFFD && n == 1)
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+// functions on strings; negative lengths give empty strings
+
+inline int utf8_length(const std::string &text) {
+    return utf8_count(text.data(), text.size());
+}
+
+// first len characters
+inline std::string utf8_sub_left(const std::string &text, int len = 0) {
+    if (len <= 0)
+        return "";
+    return text.substr(0, utf8_left(text.data(), text.size(), len));
+}
+
+// last len characters
+inline std::string utf8_sub_right(const std::string &text, int len = 0) {
+    if (len <= 0)
+        return "";
+    return text.substr(utf8_right(text.data(), text.size(), len));
+}
+
+#endif
@@ -42,15 +42,30 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_index_types
-List cpp_index_types(const CharacterVector& patterns_, const CharacterVector& types_, bool glob);
-RcppExport SEXP _quanteda_cpp_index_types(SEXP patterns_SEXP, SEXP types_SEXP, SEXP globSEXP) {
+List cpp_index_types(const CharacterVector& patterns_, const CharacterVector& types_, const bool glob, const int thread);
+RcppExport SEXP _quanteda_cpp_index_types(SEXP patterns_SEXP, SEXP types_SEXP, SEXP globSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const CharacterVector& >::type patterns_(patterns_SEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type types_(types_SEXP);
-    Rcpp::traits::input_parameter< bool >::type glob(globSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_index_types(patterns_, types_, glob));
+    Rcpp::traits::input_parameter< const bool >::type glob(globSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_index_types(patterns_, types_, glob, thread));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_index_regex
+List cpp_index_regex(const CharacterVector& patterns_, const CharacterVector& types_, const bool case_insensitive, const int thread);
+RcppExport SEXP _quanteda_cpp_index_regex(SEXP patterns_SEXP, SEXP types_SEXP, SEXP case_insensitiveSEXP, SEXP threadSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type patterns_(patterns_SEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type types_(types_SEXP);
+    Rcpp::traits::input_parameter< const bool >::type case_insensitive(case_insensitiveSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_index_regex(patterns_, types_, case_insensitive, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -79,6 +94,49 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_drop_dictionary
+TokensPtr cpp_drop_dictionary(TokensPtr xptr);
+RcppExport SEXP _quanteda_cpp_drop_dictionary(SEXP xptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_drop_dictionary(xptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_tokenize_add
+TokensPtr cpp_tokenize_add(const CharacterVector& texts_, TokensPtr xptr, const bool fastest, const int thread);
+RcppExport SEXP _quanteda_cpp_tokenize_add(SEXP texts_SEXP, SEXP xptrSEXP, SEXP fastestSEXP, SEXP threadSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type texts_(texts_SEXP);
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const bool >::type fastest(fastestSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_tokenize_add(texts_, xptr, fastest, thread));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_tokenize_file
+List cpp_tokenize_file(const String& file_, TokensPtr xptr, const bool jsonl, const String& text_field_, const String& docid_field_, const bool fastest, const double chunk_size, const int thread);
+RcppExport SEXP _quanteda_cpp_tokenize_file(SEXP file_SEXP, SEXP xptrSEXP, SEXP jsonlSEXP, SEXP text_field_SEXP, SEXP docid_field_SEXP, SEXP fastestSEXP, SEXP chunk_sizeSEXP, SEXP threadSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const String& >::type file_(file_SEXP);
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const bool >::type jsonl(jsonlSEXP);
+    Rcpp::traits::input_parameter< const String& >::type text_field_(text_field_SEXP);
+    Rcpp::traits::input_parameter< const String& >::type docid_field_(docid_field_SEXP);
+    Rcpp::traits::input_parameter< const bool >::type fastest(fastestSEXP);
+    Rcpp::traits::input_parameter< const double >::type chunk_size(chunk_sizeSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_tokenize_file(file_, xptr, jsonl, text_field_, docid_field_, fastest, chunk_size, thread));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_tokens_chunk
 TokensPtr cpp_tokens_chunk(TokensPtr xptr, const int size, const int overlap, const int thread);
 RcppExport SEXP _quanteda_cpp_tokens_chunk(SEXP xptrSEXP, SEXP sizeSEXP, SEXP overlapSEXP, SEXP threadSEXP) {
@@ -153,6 +211,23 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_dfm_lookup
+S4 cpp_dfm_lookup(TokensPtr xptr, const List& words_, const IntegerVector& keys_, const CharacterVector& types_, const int overlap, const int nomatch, const int thread);
+RcppExport SEXP _quanteda_cpp_dfm_lookup(SEXP xptrSEXP, SEXP words_SEXP, SEXP keys_SEXP, SEXP types_SEXP, SEXP overlapSEXP, SEXP nomatchSEXP, SEXP threadSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const List& >::type words_(words_SEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type keys_(keys_SEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type types_(types_SEXP);
+    Rcpp::traits::input_parameter< const int >::type overlap(overlapSEXP);
+    Rcpp::traits::input_parameter< const int >::type nomatch(nomatchSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_dfm_lookup(xptr, words_, keys_, types_, overlap, nomatch, thread));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_tokens_ngrams
 TokensPtr cpp_tokens_ngrams(TokensPtr xptr, const String delim_, const IntegerVector ns_, const IntegerVector skips_, const int thread);
 RcppExport SEXP _quanteda_cpp_tokens_ngrams(SEXP xptrSEXP, SEXP delim_SEXP, SEXP ns_SEXP, SEXP skips_SEXP, SEXP threadSEXP) {
@@ -169,8 +244,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_tokens_recompile
-List cpp_tokens_recompile(const List& texts_, const CharacterVector types_, const bool gap, const bool dup);
-RcppExport SEXP _quanteda_cpp_tokens_recompile(SEXP texts_SEXP, SEXP types_SEXP, SEXP gapSEXP, SEXP dupSEXP) {
+List cpp_tokens_recompile(const List& texts_, const CharacterVector types_, const bool gap, const bool dup, const int thread);
+RcppExport SEXP _quanteda_cpp_tokens_recompile(SEXP texts_SEXP, SEXP types_SEXP, SEXP gapSEXP, SEXP dupSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -178,7 +253,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const CharacterVector >::type types_(types_SEXP);
     Rcpp::traits::input_parameter< const bool >::type gap(gapSEXP);
     Rcpp::traits::input_parameter< const bool >::type dup(dupSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_tokens_recompile(texts_, types_, gap, dup));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_tokens_recompile(texts_, types_, gap, dup, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -211,6 +287,30 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_save_xptr
+void cpp_save_xptr(TokensPtr xptr, const String& file_, const RawVector& attrs_);
+RcppExport SEXP _quanteda_cpp_save_xptr(SEXP xptrSEXP, SEXP file_SEXP, SEXP attrs_SEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const String& >::type file_(file_SEXP);
+    Rcpp::traits::input_parameter< const RawVector& >::type attrs_(attrs_SEXP);
+    cpp_save_xptr(xptr, file_, attrs_);
+    return R_NilValue;
+END_RCPP
+}
+// cpp_load_xptr
+List cpp_load_xptr(const String& file_, const bool mmap);
+RcppExport SEXP _quanteda_cpp_load_xptr(SEXP file_SEXP, SEXP mmapSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const String& >::type file_(file_SEXP);
+    Rcpp::traits::input_parameter< const bool >::type mmap(mmapSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_load_xptr(file_, mmap));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_tokens_segment
 TokensPtr cpp_tokens_segment(TokensPtr xptr, const List& patterns_, const bool& remove, const int& position, const int thread);
 RcppExport SEXP _quanteda_cpp_tokens_segment(SEXP xptrSEXP, SEXP patterns_SEXP, SEXP removeSEXP, SEXP positionSEXP, SEXP threadSEXP) {
@@ -246,14 +346,17 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_as_xptr
-TokensPtr cpp_as_xptr(const List text_, const CharacterVector types_);
-RcppExport SEXP _quanteda_cpp_as_xptr(SEXP text_SEXP, SEXP types_SEXP) {
+TokensPtr cpp_as_xptr(const List text_, const CharacterVector types_, const bool flat, const bool compact, const int thread);
+RcppExport SEXP _quanteda_cpp_as_xptr(SEXP text_SEXP, SEXP types_SEXP, SEXP flatSEXP, SEXP compactSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const List >::type text_(text_SEXP);
     Rcpp::traits::input_parameter< const CharacterVector >::type types_(types_SEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_as_xptr(text_, types_));
+    Rcpp::traits::input_parameter< const bool >::type flat(flatSEXP);
+    Rcpp::traits::input_parameter< const bool >::type compact(compactSEXP);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_as_xptr(text_, types_, flat, compact, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -268,6 +371,30 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_set_flat
+TokensPtr cpp_set_flat(TokensPtr xptr, const bool flat);
+RcppExport SEXP _quanteda_cpp_set_flat(SEXP xptrSEXP, SEXP flatSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const bool >::type flat(flatSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_set_flat(xptr, flat));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_set_compact
+TokensPtr cpp_set_compact(TokensPtr xptr, const bool compact);
+RcppExport SEXP _quanteda_cpp_set_compact(SEXP xptrSEXP, SEXP compactSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const bool >::type compact(compactSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_set_compact(xptr, compact));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_get_attributes
 List cpp_get_attributes(TokensPtr xptr);
 RcppExport SEXP _quanteda_cpp_get_attributes(SEXP xptrSEXP) {
@@ -280,13 +407,14 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_as_list
-List cpp_as_list(TokensPtr xptr);
-RcppExport SEXP _quanteda_cpp_as_list(SEXP xptrSEXP) {
+List cpp_as_list(TokensPtr xptr, const int thread);
+RcppExport SEXP _quanteda_cpp_as_list(SEXP xptrSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_as_list(xptr));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_as_list(xptr, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -302,6 +430,30 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cpp_compile_patterns
+SEXP cpp_compile_patterns(TokensPtr xptr, const List& words_);
+RcppExport SEXP _quanteda_cpp_compile_patterns(SEXP xptrSEXP, SEXP words_SEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< const List& >::type words_(words_SEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_compile_patterns(xptr, words_));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_check_patterns
+bool cpp_check_patterns(TokensPtr xptr, SEXP compiled_);
+RcppExport SEXP _quanteda_cpp_check_patterns(SEXP xptrSEXP, SEXP compiled_SEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type compiled_(compiled_SEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_check_patterns(xptr, compiled_));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cpp_ndoc
 int cpp_ndoc(TokensPtr xptr);
 RcppExport SEXP _quanteda_cpp_ndoc(SEXP xptrSEXP) {
@@ -314,36 +466,39 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_ntoken
-IntegerVector cpp_ntoken(TokensPtr xptr);
-RcppExport SEXP _quanteda_cpp_ntoken(SEXP xptrSEXP) {
+IntegerVector cpp_ntoken(TokensPtr xptr, const int thread);
+RcppExport SEXP _quanteda_cpp_ntoken(SEXP xptrSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_ntoken(xptr));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_ntoken(xptr, thread));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_ntype
-IntegerVector cpp_ntype(TokensPtr xptr);
-RcppExport SEXP _quanteda_cpp_ntype(SEXP xptrSEXP) {
+IntegerVector cpp_ntype(TokensPtr xptr, const int thread);
+RcppExport SEXP _quanteda_cpp_ntype(SEXP xptrSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_ntype(xptr));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_ntype(xptr, thread));
     return rcpp_result_gen;
 END_RCPP
 }
 // cpp_get_types
-CharacterVector cpp_get_types(TokensPtr xptr, bool recompile);
-RcppExport SEXP _quanteda_cpp_get_types(SEXP xptrSEXP, SEXP recompileSEXP) {
+CharacterVector cpp_get_types(TokensPtr xptr, bool recompile, const int thread);
+RcppExport SEXP _quanteda_cpp_get_types(SEXP xptrSEXP, SEXP recompileSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
     Rcpp::traits::input_parameter< bool >::type recompile(recompileSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_get_types(xptr, recompile));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_get_types(xptr, recompile, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -360,24 +515,26 @@ BEGIN_RCPP
 END_RCPP
 }
 // cpp_recompile
-void cpp_recompile(TokensPtr xptr);
-RcppExport SEXP _quanteda_cpp_recompile(SEXP xptrSEXP) {
+void cpp_recompile(TokensPtr xptr, const int thread);
+RcppExport SEXP _quanteda_cpp_recompile(SEXP xptrSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
-    cpp_recompile(xptr);
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    cpp_recompile(xptr, thread);
     return R_NilValue;
 END_RCPP
 }
 // cpp_dfm
-S4 cpp_dfm(TokensPtr xptr, bool asis);
-RcppExport SEXP _quanteda_cpp_dfm(SEXP xptrSEXP, SEXP asisSEXP) {
+S4 cpp_dfm(TokensPtr xptr, bool asis, const int thread);
+RcppExport SEXP _quanteda_cpp_dfm(SEXP xptrSEXP, SEXP asisSEXP, SEXP threadSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< TokensPtr >::type xptr(xptrSEXP);
     Rcpp::traits::input_parameter< bool >::type asis(asisSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_dfm(xptr, asis));
+    Rcpp::traits::input_parameter< const int >::type thread(threadSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_dfm(xptr, asis, thread));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -461,32 +618,43 @@ END_RCPP
 static const R_CallMethodDef CallEntries[] = {
     {"_quanteda_cpp_fcm", (DL_FUNC) &_quanteda_cpp_fcm, 6},
     {"_quanteda_cpp_index", (DL_FUNC) &_quanteda_cpp_index, 3},
-    {"_quanteda_cpp_index_types", (DL_FUNC) &_quanteda_cpp_index_types, 3},
+    {"_quanteda_cpp_index_types", (DL_FUNC) &_quanteda_cpp_index_types, 4},
+    {"_quanteda_cpp_index_regex", (DL_FUNC) &_quanteda_cpp_index_regex, 4},
     {"_quanteda_cpp_serialize", (DL_FUNC) &_quanteda_cpp_serialize, 2},
     {"_quanteda_cpp_serialize_add", (DL_FUNC) &_quanteda_cpp_serialize_add, 3},
+    {"_quanteda_cpp_drop_dictionary", (DL_FUNC) &_quanteda_cpp_drop_dictionary, 1},
+    {"_quanteda_cpp_tokenize_add", (DL_FUNC) &_quanteda_cpp_tokenize_add, 4},
+    {"_quanteda_cpp_tokenize_file", (DL_FUNC) &_quanteda_cpp_tokenize_file, 8},
     {"_quanteda_cpp_tokens_chunk", (DL_FUNC) &_quanteda_cpp_tokens_chunk, 4},
     {"_quanteda_cpp_tokens_combine", (DL_FUNC) &_quanteda_cpp_tokens_combine, 3},
     {"_quanteda_cpp_tokens_compound", (DL_FUNC) &_quanteda_cpp_tokens_compound, 7},
     {"_quanteda_cpp_tokens_group", (DL_FUNC) &_quanteda_cpp_tokens_group, 3},
     {"_quanteda_cpp_tokens_lookup", (DL_FUNC) &_quanteda_cpp_tokens_lookup, 7},
+    {"_quanteda_cpp_dfm_lookup", (DL_FUNC) &_quanteda_cpp_dfm_lookup, 7},
     {"_quanteda_cpp_tokens_ngrams", (DL_FUNC) &_quanteda_cpp_tokens_ngrams, 5},
-    {"_quanteda_cpp_tokens_recompile", (DL_FUNC) &_quanteda_cpp_tokens_recompile, 4},
+    {"_quanteda_cpp_tokens_recompile", (DL_FUNC) &_quanteda_cpp_tokens_recompile, 5},
     {"_quanteda_cpp_tokens_replace", (DL_FUNC) &_quanteda_cpp_tokens_replace, 4},
     {"_quanteda_cpp_tokens_restore", (DL_FUNC) &_quanteda_cpp_tokens_restore, 5},
+    {"_quanteda_cpp_save_xptr", (DL_FUNC) &_quanteda_cpp_save_xptr, 3},
+    {"_quanteda_cpp_load_xptr", (DL_FUNC) &_quanteda_cpp_load_xptr, 2},
     {"_quanteda_cpp_tokens_segment", (DL_FUNC) &_quanteda_cpp_tokens_segment, 5},
     {"_quanteda_cpp_tokens_select", (DL_FUNC) &_quanteda_cpp_tokens_select, 9},
-    {"_quanteda_cpp_as_xptr", (DL_FUNC) &_quanteda_cpp_as_xptr, 2},
+    {"_quanteda_cpp_as_xptr", (DL_FUNC) &_quanteda_cpp_as_xptr, 5},
     {"_quanteda_cpp_copy_xptr", (DL_FUNC) &_quanteda_cpp_copy_xptr, 1},
+    {"_quanteda_cpp_set_flat", (DL_FUNC) &_quanteda_cpp_set_flat, 2},
+    {"_quanteda_cpp_set_compact", (DL_FUNC) &_quanteda_cpp_set_compact, 2},
     {"_quanteda_cpp_get_attributes", (DL_FUNC) &_quanteda_cpp_get_attributes, 1},
-    {"_quanteda_cpp_as_list", (DL_FUNC) &_quanteda_cpp_as_list, 1},
+    {"_quanteda_cpp_as_list", (DL_FUNC) &_quanteda_cpp_as_list, 2},
     {"_quanteda_cpp_subset", (DL_FUNC) &_quanteda_cpp_subset, 2},
+    {"_quanteda_cpp_compile_patterns", (DL_FUNC) &_quanteda_cpp_compile_patterns, 2},
+    {"_quanteda_cpp_check_patterns", (DL_FUNC) &_quanteda_cpp_check_patterns, 2},
     {"_quanteda_cpp_ndoc", (DL_FUNC) &_quanteda_cpp_ndoc, 1},
-    {"_quanteda_cpp_ntoken", (DL_FUNC) &_quanteda_cpp_ntoken, 1},
-    {"_quanteda_cpp_ntype", (DL_FUNC) &_quanteda_cpp_ntype, 1},
-    {"_quanteda_cpp_get_types", (DL_FUNC) &_quanteda_cpp_get_types, 2},
+    {"_quanteda_cpp_ntoken", (DL_FUNC) &_quanteda_cpp_ntoken, 2},
+    {"_quanteda_cpp_ntype", (DL_FUNC) &_quanteda_cpp_ntype, 2},
+    {"_quanteda_cpp_get_types", (DL_FUNC) &_quanteda_cpp_get_types, 3},
     {"_quanteda_cpp_set_types", (DL_FUNC) &_quanteda_cpp_set_types, 2},
-    {"_quanteda_cpp_recompile", (DL_FUNC) &_quanteda_cpp_recompile, 1},
-    {"_quanteda_cpp_dfm", (DL_FUNC) &_quanteda_cpp_dfm, 2},
+    {"_quanteda_cpp_recompile", (DL_FUNC) &_quanteda_cpp_recompile, 2},
+    {"_quanteda_cpp_dfm", (DL_FUNC) &_quanteda_cpp_dfm, 3},
     {"_quanteda_cpp_is_grouped_numeric", (DL_FUNC) &_quanteda_cpp_is_grouped_numeric, 2},
     {"_quanteda_cpp_is_grouped_character", (DL_FUNC) &_quanteda_cpp_is_grouped_character, 2},
     {"_quanteda_cpp_get_load_factor", (DL_FUNC) &_quanteda_cpp_get_load_factor, 0},
@@ -497,7 +665,9 @@ static const R_CallMethodDef CallEntries[] = {
     {NULL, NULL, 0}
 };
 
+void cpp_register_altrep(DllInfo* dll);
 RcppExport void R_init_quanteda(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    cpp_register_altrep(dll);
 }
@@ -2,16 +2,6 @@
 //#include "dev.h"
 using namespace quanteda;
 
-struct hash_pair {
-  size_t operator()(const std::pair<unsigned int, unsigned int> &p) const {
-    
-    unsigned int seed = 0;
-    seed = p.first;
-    seed += p.second << 16;
-    return std::hash<unsigned int>()(seed);
-  }
-};
-
 struct equal_pair {
   bool operator() (const std::pair<unsigned int, unsigned int> &p1,
                    const std::pair<unsigned int, unsigned int> &p2) const {
@@ -32,7 +22,7 @@ bool exist(const unsigned int &x, const unsigned int &y,
 }
 
 //count the co-occurance when count is set to "frequency" or "weighted"
-void count_col(const Text &text,
+void count_col(const TextView &text,
                const std::vector<double> &weights,    
                const unsigned int &window,
                const bool &ordered,
@@ -89,9 +79,8 @@ S4 cpp_fcm(TokensPtr xptr,
                 const int thread = -1) {
     
     // triplets are constructed according to tri & ordered settings to be efficient
-    xptr->recompile();
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    xptr->recompile(thread);
+    const TokensObj &obj = *xptr;
     std::vector<double> weights = Rcpp::as< std::vector<double> >(weights_);
     unsigned int window = weights.size();
 
@@ -100,19 +89,19 @@ S4 cpp_fcm(TokensPtr xptr,
 
     //dev::Timer timer;
     //dev::start_timer("Count", timer);
-    std::size_t H = texts.size();
+    std::size_t H = obj.size();
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
         arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
             for (int h = r.begin(); h < r.end(); ++h) {
-                count_col(texts[h], weights, window, ordered, boolean, fcm_tri);
+                count_col(obj.text(h), weights, window, ordered, boolean, fcm_tri);
             }    
         });
     });
 #else        
     for (std::size_t h = 0; h < H; h++) {
-        count_col(texts[h], weights, window, ordered, boolean, fcm_tri);
+        count_col(obj.text(h), weights, window, ordered, boolean, fcm_tri);
     }
 #endif
     
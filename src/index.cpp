@@ -1,29 +1,24 @@
 #include "lib.h"
+#include "automaton.h"
 //#include "dev.h"
 using namespace quanteda;
 
 typedef std::tuple<unsigned int, size_t, size_t> Match;
 typedef std::vector<Match> Matches;
 
-Matches index(Text tokens,
-                   const std::vector<std::size_t> &spans,
-                   const MultiMapNgrams &map_pats,
+Matches index(const TextView &tokens,
+                   const Automaton &automaton,
                    UintParam &N){
     
     if(tokens.size() == 0) return {}; // return empty vector for empty text
     
     Matches matches;
-    matches.reserve(tokens.size());
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto range = map_pats.equal_range(ngram);
-            for (auto it = range.first; it != range.second; ++it) {
-                unsigned int pat = it->second;
-                matches.push_back(std::make_tuple(pat, i, i + span - 1));
-                N++;
-            }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    matches.reserve(hits.size());
+    for (const Hit &hit : hits) {
+        for (unsigned int pat : automaton.values(hit)) {
+            matches.push_back(std::make_tuple(pat, hit.pos, hit.pos + hit.span - 1));
+            N++;
         }
     }
     
@@ -47,48 +42,29 @@ DataFrame cpp_index(TokensPtr xptr,
                     const List &words_,
                     const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    const TokensObj &obj = *xptr;
 
-    MultiMapNgrams map_pats;
-    map_pats.max_load_factor(GLOBAL_PATTERN_MAX_LOAD_FACTOR);
-    Ngrams words = Rcpp::as<Ngrams>(words_);
-    std::vector<unsigned int> pats(words_.size());
-    unsigned int p = 0;
-    for (size_t f = 0; f < pats.size(); f++) {
-        pats[f] = p++;
-    }
-    
-    size_t len = words.size();
-    std::vector<std::size_t> spans(len);
-    for (size_t g = 0; g < len; g++) {
-        Ngram value = words[g];
-        unsigned int pat = pats[g];
-        map_pats.insert(std::pair<Ngram, unsigned int>(value, pat));
-        spans[g] = value.size();
-    }
-    sort(spans.begin(), spans.end());
-    spans.erase(unique(spans.begin(), spans.end()), spans.end());
-    std::reverse(std::begin(spans), std::end(spans));
+    Automaton automaton_temp;
+    const Automaton &automaton = get_patterns(words_, obj, automaton_temp);
     
     //dev::Timer timer;
-    std::vector<Matches> temp(texts.size());
+    std::size_t H = obj.size();
+    std::vector<Matches> temp(H);
     
     //dev::start_timer("Search keywords", timer);
     UintParam N = 0;
-    std::size_t H = texts.size();
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
             for (int h = r.begin(); h < r.end(); ++h) {
-                temp[h] = index(texts[h], spans, map_pats, N);
+                temp[h] = index(obj.text(h), automaton, N);
             }    
         });
     });
 #else
     for (std::size_t h = 0; h < H; h++) {
-        temp[h] = index(texts[h], spans, map_pats, N);
+        temp[h] = index(obj.text(h), automaton, N);
     }
 #endif
     //dev::stop_timer("Search keywords", timer);
@@ -101,7 +77,6 @@ DataFrame cpp_index(TokensPtr xptr,
     for (std::size_t h = 0; h < temp.size(); h++) {
         Matches matches = temp[h];
         if (matches.size() == 0) continue;
-        Text tokens = texts[h];
         for (size_t i = 0; i < matches.size(); i++) {
             Match match = matches[i];
             patterns_[j] = std::get<0>(match) + 1;
@@ -1,170 +1,839 @@
 #include "lib.h"
 #include "dev.h"
 #include "utf8.h"
+#include <regex>
 using namespace quanteda;
 
-#if QUANTEDA_USE_TBB
-typedef tbb::concurrent_unordered_map<Type, tbb::concurrent_vector<int> > MapIndex;
-#else 
-typedef std::unordered_map<Type, std::vector<int> > MapIndex;
-#endif
 typedef std::string Pattern;
 typedef std::vector<Pattern> Patterns;
-typedef std::tuple<int, std::string, int> Config;
-typedef std::vector<Config> Configs;
-
-void index_types(Types &types, MapIndex &index, Config conf) {
-    
-    int len, side;
-    std::string wildcard;
-    std::tie(side, wildcard, len) = conf;
-    //Rcout << "Side: " << side << " wildcard: " << wildcard << " len: " << len << "\n";
-    
+typedef std::vector<int> TypeIds;
+
+/*
+ * Glob patterns are split at the first and the last wildcards into a literal
+ * prefix, a body and a literal suffix, e.g. "econ*om?c" into "econ", "*om?"
+ * and "c". Types are selected by the prefix or the suffix before the body
+ * is matched.
+ */
+struct Glob {
+    std::string prefix;
+    std::string body; // starts and ends with wildcards
+    std::string suffix;
+    std::size_t size; // minimum number of bytes of matching types
+    bool any; // if TRUE, the body is only '*'
+};
+
+Glob parse_glob(const Pattern &pattern) {
+    Glob glob;
+    std::size_t first = pattern.find_first_of("*?");
+    std::size_t last = pattern.find_last_of("*?");
+    glob.prefix = pattern.substr(0, first);
+    glob.body = pattern.substr(first, last - first + 1);
+    glob.suffix = pattern.substr(last + 1);
+    glob.size = glob.prefix.size() + glob.suffix.size();
+    glob.any = true;
+    for (char c : glob.body) {
+        if (c != '*') {
+            glob.size++; // a character of '?' is at least one byte
+            glob.any = false;
+        }
+    }
+    return glob;
+}
+
+inline const char* next_char(const char *s, const char *end) {
+    s++;
+    while (s < end && !utf8_is_lead(*s))
+        s++;
+    return s;
+}
+
+// match bytes with a pattern in which '?' is a character and '*' is any
+// characters; restarts from the last '*' on mismatches
+bool match_glob(const char *p, const char *p_end, const char *s, const char *s_end) {
+    const char *p_star = NULL, *s_star = NULL;
+    while (s < s_end) {
+        if (p < p_end && *p == '*') {
+            p_star = ++p;
+            s_star = s;
+        } else if (p < p_end && *p == '?') {
+            p++;
+            s = next_char(s, s_end);
+        } else if (p < p_end && *p == *s) {
+            p++;
+            s++;
+        } else if (p_star) {
+            p = p_star;
+            s = s_star = next_char(s_star, s_end);
+        } else {
+            return false;
+        }
+    }
+    while (p < p_end && *p == '*')
+        p++;
+    return p == p_end;
+}
+
+bool match_type(const Glob &glob, const Type &type) {
+    if (type.size() < glob.size)
+        return false;
+    if (type.compare(0, glob.prefix.size(), glob.prefix) != 0)
+        return false;
+    if (type.compare(type.size() - glob.suffix.size(), glob.suffix.size(), glob.suffix) != 0)
+        return false;
+    if (glob.any)
+        return true;
+    const char *s = type.data();
+    return match_glob(glob.body.data(), glob.body.data() + glob.body.size(),
+                      s + glob.prefix.size(), s + type.size() - glob.suffix.size());
+}
+
+// compare the ends of strings in reverse order of bytes
+inline int compare_reverse(const Type &type, const std::string &suffix) {
+    auto it1 = type.rbegin();
+    auto it2 = suffix.rbegin();
+    for (; it1 != type.rend() && it2 != suffix.rend(); ++it1, ++it2) {
+        if (*it1 != *it2)
+            return (unsigned char)*it1 < (unsigned char)*it2 ? -1 : 1;
+    }
+    if (it2 == suffix.rend())
+        return 0;
+    return -1;
+}
+
+// types sorted by their beginnings or ends to find types by prefix or suffix
+struct SortedTypes {
+    const Types &types;
+    TypeIds ids;
+    bool reverse;
+
+    SortedTypes(const Types &types_, bool reverse_): types(types_), reverse(reverse_) {}
+
+    void sort() {
+        ids.resize(types.size());
+        for (std::size_t h = 0; h < ids.size(); h++)
+            ids[h] = h;
+        auto less = [&](int i, int j) {
+            if (reverse)
+                return std::lexicographical_compare(
+                    types[i].rbegin(), types[i].rend(), types[j].rbegin(), types[j].rend(),
+                    [](char a, char b) { return (unsigned char)a < (unsigned char)b; });
+            return types[i] < types[j];
+        };
+#if QUANTEDA_USE_TBB
+        tbb::parallel_sort(ids.begin(), ids.end(), less);
+#else
+        std::sort(ids.begin(), ids.end(), less);
+#endif
+    }
+
+    int compare(int i, const std::string &str) const {
+        if (reverse)
+            return compare_reverse(types[i], str);
+        return types[i].compare(0, str.size(), str);
+    }
+
+    // types that start or end with str
+    std::pair<TypeIds::const_iterator, TypeIds::const_iterator> find(const std::string &str) const {
+        auto begin = std::partition_point(ids.begin(), ids.end(), [&](int i) {
+            return compare(i, str) < 0;
+        });
+        auto end = std::partition_point(begin, ids.end(), [&](int i) {
+            return compare(i, str) == 0;
+        });
+        return std::make_pair(begin, end);
+    }
+};
+
+void index_glob(const Types &types, const Glob &glob,
+                const SortedTypes &forward, const SortedTypes &backward,
+                TypeIds &result) {
+
+    const SortedTypes *sorted = NULL;
+    if (!glob.prefix.empty() && !forward.ids.empty()) {
+        sorted = &forward;
+    } else if (!glob.suffix.empty() && !backward.ids.empty()) {
+        sorted = &backward;
+    }
+    if (sorted) {
+        auto range = sorted->find(sorted->reverse ? glob.suffix : glob.prefix);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (match_type(glob, types[*it]))
+                result.push_back(*it);
+        }
+        std::sort(result.begin(), result.end());
+    } else {
+        for (std::size_t h = 0; h < types.size(); h++) {
+            if (match_type(glob, types[h]))
+                result.push_back(h);
+        }
+    }
+}
+
+/*
+ * Function to find types that match fixed or glob patterns
+ * @used index_types()
+ * @param glob if TRUE, patterns are globs; otherwise fixed
+ * @return a list of type IDs for each pattern
+ */
+
+// [[Rcpp::export]]
+List cpp_index_types(const CharacterVector &patterns_,
+                     const CharacterVector &types_,
+                     const bool glob = true,
+                     const int thread = -1) {
+
+    //dev::Timer timer;
+    //dev::start_timer("Convert", timer);
+
+    Patterns patterns = Rcpp::as<Patterns>(patterns_);
+    Types types = Rcpp::as<Types>(types_);
+
+    // unique patterns
+    std::unordered_map<Pattern, std::size_t> map_pattern;
+    std::vector<std::size_t> pos(patterns.size());
+    for (std::size_t i = 0; i < patterns.size(); i++) {
+        auto it = map_pattern.insert(std::make_pair(patterns[i], map_pattern.size()));
+        pos[i] = it.first->second;
+    }
+    std::vector<TypeIds> temp(map_pattern.size());
+
+    // fixed patterns are found in a single scan
+    std::unordered_map<Pattern, std::size_t> map_fixed;
+    std::vector<Glob> globs;
+    std::vector<std::size_t> pos_glob;
+    std::size_t n_prefix = 0, n_suffix = 0;
+    for (auto &it : map_pattern) {
+        if (!glob || it.first.find_first_of("*?") == std::string::npos) {
+            map_fixed.insert(it);
+        } else {
+            globs.push_back(parse_glob(it.first));
+            pos_glob.push_back(it.second);
+            if (!globs.back().prefix.empty()) {
+                n_prefix++;
+            } else if (!globs.back().suffix.empty()) {
+                n_suffix++;
+            }
+        }
+    }
+    if (!map_fixed.empty()) {
+        for (std::size_t h = 0; h < types.size(); h++) {
+            auto it = map_fixed.find(types[h]);
+            if (it != map_fixed.end())
+                temp[it->second].push_back(h);
+        }
+    }
+
+    //dev::stop_timer("Convert", timer);
+    //dev::start_timer("Index", timer);
+
+    // sorting costs about as much as log2(H) scans of types
     std::size_t H = types.size();
-    Types temp(H);
-    
-    for (size_t h = 0; h < H; h++) {
-        std::string value;
-        if (side == 1) {
-            if (len > 0) {
-                value = utf8_sub_right(types[h], len);
+    std::size_t L = 1;
+    while (((std::size_t)1 << L) < H)
+        L++;
+    SortedTypes forward(types, false), backward(types, true);
+    if (n_prefix > L)
+        forward.sort();
+    if (n_suffix > L)
+        backward.sort();
+
+    std::size_t G = globs.size();
+#if QUANTEDA_USE_TBB
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, G), [&](tbb::blocked_range<int> r) {
+            for (int g = r.begin(); g < r.end(); ++g) {
+                index_glob(types, globs[g], forward, backward, temp[pos_glob[g]]);
+            }
+        });
+    });
+#else
+    for (std::size_t g = 0; g < G; g++) {
+        index_glob(types, globs[g], forward, backward, temp[pos_glob[g]]);
+    }
+#endif
+    //dev::stop_timer("Index", timer);
+
+    //dev::start_timer("List", timer);
+    List result_(patterns.size());
+    for (size_t i = 0; i < patterns.size(); i++) {
+        IntegerVector value_ = Rcpp::wrap(temp[pos[i]]);
+        result_[i] = value_ + 1; // R is 1 base
+    }
+    result_.attr("names") = encode(patterns);
+    //dev::stop_timer("List", timer);
+
+    return result_;
+}
+
+/*
+ * Regular expressions are translated from ICU's syntax to ECMAScript's and
+ * matched against types as sequences of code points by std::wregex. Patterns
+ * with other features (e.g. Unicode properties, lookbehind or inline flags)
+ * are not translated and left to stringi in R.
+ */
+struct Regex {
+    std::wregex regex;
+    std::string prefix; // literal characters after '^'
+    std::string literal; // longest literal characters that matching types contain
+    bool ascii; // if TRUE, \w, \d, \s or \b only work on ASCII types
+};
+
+typedef std::vector<wchar_t> Wchars;
+
+// ICU's line terminators, which '.' does not match and '$' can precede
+const std::wstring terminators = L"\\n\\x0B\\f\\r\\u0085\\u2028\\u2029";
+const std::size_t max_regex_length = 1000; // std::wregex recurses for each character
+
+inline bool is_ascii_alnum(uint32_t c) {
+    return ('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+// characters that are not lowercased but match ASCII letters in ICU when case
+// insensitive (e.g. "ß" matches "ss")
+inline bool is_folded(uint32_t c) {
+    return c == 0x00DF || c == 0x0130 || c == 0x0149 || c == 0x017F || c == 0x01F0 ||
+           (0x1E96 <= c && c <= 0x1E9A) || c == 0x1E9E || c == 0x212A ||
+           (0xFB00 <= c && c <= 0xFB06);
+}
+
+inline void append_wchar(uint32_t c, std::wstring &str) {
+#if WCHAR_MAX <= 0xFFFF
+    if (c > 0xFFFF) {
+        c -= 0x10000;
+        str += (wchar_t)(0xD800 + (c >> 10));
+        str += (wchar_t)(0xDC00 + (c & 0x3FF));
+        return;
+    }
+#endif
+    str += (wchar_t)c;
+}
+
+// append a literal character escaping ECMAScript's special characters
+void append_literal(uint32_t c, std::wstring &str) {
+    if (c < 0x20 || c == 0x7F) {
+        const char *hex = "0123456789ABCDEF";
+        str += L"\\x";
+        str += (wchar_t)hex[c >> 4];
+        str += (wchar_t)hex[c & 0xF];
+    } else if (c < 0x80 && c != ' ' && !is_ascii_alnum(c)) {
+        str += L'\\';
+        str += (wchar_t)c;
+    } else {
+        append_wchar(c, str);
+    }
+}
+
+// code points of a pattern
+struct Reader {
+    const std::string &str;
+    std::size_t pos;
+
+    Reader(const std::string &str_): str(str_), pos(0) {}
+
+    bool end() const {
+        return pos >= str.size();
+    }
+    uint32_t peek() const {
+        std::size_t n;
+        return utf8_decode(str.data() + pos, str.size() - pos, n);
+    }
+    uint32_t next() {
+        std::size_t n;
+        uint32_t c = utf8_decode(str.data() + pos, str.size() - pos, n);
+        pos += n;
+        return c;
+    }
+    bool skip(uint32_t c) {
+        if (end() || peek() != c)
+            return false;
+        next();
+        return true;
+    }
+    // digits of a number in base 10 or 16; returns -1 if there are none
+    long number(std::size_t size, int base) {
+        long v = 0;
+        std::size_t k = 0;
+        while (k < size && !end()) {
+            uint32_t c = peek();
+            int d;
+            if ('0' <= c && c <= '9') {
+                d = c - '0';
+            } else if (base == 16 && 'a' <= (c | 0x20) && (c | 0x20) <= 'f') {
+                d = (c | 0x20) - 'a' + 10;
             } else {
-                value = utf8_sub_right(types[h], utf8_length(types[h]) + len);
+                break;
+            }
+            if (v > 0x10FFFF)
+                return -1;
+            v = v * base + d;
+            next();
+            k++;
+        }
+        return k == 0 ? -1 : v;
+    }
+};
+
+// code point of an escaped literal character, e.g. \t or \x{1F600}; returns
+// -1 for other escapes
+long parse_escape(uint32_t e, Reader &reader) {
+    long c = -1;
+    switch (e) {
+    case 't': return '\t';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'a': return 0x07;
+    case 'e': return 0x1B;
+    case 'u': c = reader.number(4, 16); break;
+    case 'U': c = reader.number(8, 16); break;
+    case 'x':
+        if (reader.skip('{')) {
+            c = reader.number(8, 16);
+            if (!reader.skip('}'))
+                return -1;
+        } else {
+            c = reader.number(2, 16);
+        }
+        break;
+    default:
+        if (e < 0x80 && !is_ascii_alnum(e))
+            return e;
+        return -1;
+    }
+    if (c > 0x10FFFF || (0xD800 <= c && c <= 0xDFFF))
+        return -1;
+    return c;
+}
+
+bool parse_class(Reader &reader, const bool icase, std::wstring &str, bool &ascii) {
+    str += L'[';
+    if (reader.skip('^'))
+        str += L'^';
+    if (reader.end() || reader.peek() == ']' || reader.peek() == '[')
+        return false;
+    while (!reader.end()) {
+        uint32_t c = reader.next();
+        if (c == ']') {
+            str += L']';
+            return true;
+        } else if (c == '[') {
+            return false; // nested sets and POSIX classes
+        } else if (c == '-' || c == '&') {
+            if (reader.end() || reader.peek() == c || reader.peek() == '[')
+                return false; // set operations
+            if (c == '-') {
+                str += L'-';
+                continue;
+            }
+        } else if (c == '\\') {
+            if (reader.end())
+                return false;
+            uint32_t e = reader.next();
+            if (e == 'd' || e == 'D' || e == 'w' || e == 'W' || e == 's' || e == 'S') {
+                str += L'\\';
+                str += (wchar_t)e;
+                ascii = true;
+                continue;
             }
-            if (value != "") {
-                auto it = index.find(wildcard + value);
-                if (it != index.end()) {
-                    it->second.push_back(h);
-                    //Rcout << "Insert: " << wildcard + value << " " << h << "\n";
+            long v = parse_escape(e, reader);
+            if (v < 0)
+                return false;
+            c = v;
+        }
+        if (icase && c >= 0x80)
+            return false;
+#if WCHAR_MAX <= 0xFFFF
+        if (c > 0xFFFF)
+            return false;
+#endif
+        append_literal(c, str);
+    }
+    return false;
+}
+
+/*
+ * Translate a pattern and find literal characters for filtering types
+ * @return false if the pattern cannot be translated
+ */
+bool parse_regex(const Pattern &pattern, const bool icase, Regex &regex) {
+
+    Reader reader(pattern);
+    std::wstring str;
+    std::string run; // literal characters after the last non-literal
+    std::size_t last = 0; // position of the last character in run
+    bool literal = false; // if TRUE, the last token is a literal character
+    bool anchor = false; // if TRUE, run starts after '^'
+    bool alternation = false;
+    int depth = 0;
+    std::vector<bool> lookaheads; // groups that are lookahead
+    int lookahead = 0;
+    regex.ascii = false;
+
+    // literal characters are only required outside groups
+    auto close_run = [&]() {
+        if (anchor && regex.prefix.empty())
+            regex.prefix = run;
+        if (run.size() > regex.literal.size())
+            regex.literal = run;
+        run.clear();
+        literal = anchor = false;
+    };
+
+    while (!reader.end()) {
+        std::size_t pos = reader.pos;
+        uint32_t c = reader.next();
+        if (c == '*' || c == '+' || c == '?' || c == '{') {
+            long min = c == '+' ? 1 : 0;
+            str += (wchar_t)c;
+            if (c == '{') {
+                min = reader.number(9, 10);
+                if (min < 0)
+                    return false;
+                str += std::to_wstring(min);
+                if (reader.skip(',')) {
+                    str += L',';
+                    long max = reader.number(9, 10);
+                    if (max >= 0)
+                        str += std::to_wstring(max);
                 }
-            } 
-        } else if (side == 2) {
-            if (len > 0) {
-                value = utf8_sub_left(types[h], len);
-            } else {
-                value = utf8_sub_left(types[h], utf8_length(types[h]) + len);
+                if (!reader.skip('}'))
+                    return false;
+                str += L'}';
+            }
+            if (reader.skip('?')) {
+                str += L'?';
+            } else if (!reader.end() && reader.peek() == '+') {
+                return false; // possessive
             }
-            if (value != "") {
-                auto it = index.find(value + wildcard);
-                if (it != index.end()) {
-                    it->second.push_back(h);
-                    //Rcout << "Insert: " << value + wildcard << " " << h << "\n";
+            if (literal && min == 0)
+                run.erase(last);
+            close_run();
+            continue;
+        }
+
+        long v = -1;
+        if (c == '\\') {
+            if (reader.end())
+                return false;
+            uint32_t e = reader.next();
+            if (e == 'd' || e == 'D' || e == 'w' || e == 'W' || e == 's' || e == 'S' ||
+                e == 'b' || e == 'B') {
+                if ((e == 'b' || e == 'B') && lookahead > 0)
+                    return false; // std::wregex does not see characters before lookahead
+                str += L'\\';
+                str += (wchar_t)e;
+                regex.ascii = true;
+                close_run();
+                continue;
+            } else if (e == 'A') {
+                c = '^';
+            } else if (e == 'Z') {
+                c = '$';
+            } else if (e == 'z') {
+                str += L'$';
+                close_run();
+                continue;
+            } else if (e == 'Q') {
+                while (!reader.end()) {
+                    std::size_t pos_q = reader.pos;
+                    uint32_t q = reader.next();
+                    if (q == '\\' && reader.skip('E'))
+                        break;
+                    if (icase && q >= 0x80)
+                        return false;
+                    append_literal(q, str);
+                    if (depth == 0) {
+                        last = run.size();
+                        run.append(pattern, pos_q, reader.pos - pos_q);
+                        if (icase && 'A' <= q && q <= 'Z')
+                            run[last] += 0x20;
+                        literal = true;
+                    }
                 }
+                continue;
+            } else {
+                v = parse_escape(e, reader);
+                if (v < 0)
+                    return false;
+            }
+        }
+
+        if (v < 0 && c == '^') {
+            if (lookahead > 0)
+                return false;
+            str += L'^';
+            close_run();
+            anchor = pos == 0 && !reader.end();
+        } else if (v < 0 && c == '$') {
+            str += L"(?=(?:\\r\\n|[" + terminators + L"])?$)";
+            close_run();
+        } else if (v < 0 && c == '.') {
+            str += L"[^" + terminators + L"]";
+            close_run();
+        } else if (v < 0 && c == '(') {
+            if (reader.skip('?')) {
+                if (reader.end())
+                    return false;
+                uint32_t g = reader.next();
+                if (g != ':' && g != '=' && g != '!')
+                    return false; // lookbehind, named groups and flags
+                str += L"(?";
+                str += (wchar_t)g;
+                lookaheads.push_back(g != ':');
+            } else {
+                str += L"(?:"; // no backreferences
+                lookaheads.push_back(false);
             }
+            lookahead += lookaheads.back();
+            depth++;
+            close_run();
+        } else if (v < 0 && c == ')') {
+            str += L')';
+            if (lookaheads.empty())
+                return false;
+            lookahead -= lookaheads.back();
+            lookaheads.pop_back();
+            depth--;
+            close_run();
+        } else if (v < 0 && c == '|') {
+            str += L'|';
+            if (depth == 0)
+                alternation = true;
+            close_run();
+        } else if (v < 0 && c == '[') {
+            if (!parse_class(reader, icase, str, regex.ascii))
+                return false;
+            close_run();
+        } else if (v < 0 && (c == ']' || c == '}')) {
+            return false;
         } else {
-            auto it = index.find(types[h]);
-            if (it != index.end()) {
-                it->second.push_back(h);
-                //Rcout << "Insert: " << types[h] << " " << h << "\n";
+            if (v >= 0)
+                c = v;
+            if (icase && c >= 0x80)
+                return false;
+#if WCHAR_MAX <= 0xFFFF
+            if (c > 0xFFFF)
+                return false;
+#endif
+            append_literal(c, str);
+            if (depth == 0) {
+                last = run.size();
+                if (icase && 'A' <= c && c <= 'Z')
+                    c += 0x20;
+                utf8_encode(c, run);
+                literal = true;
+            } else {
+                close_run();
             }
         }
     }
+    close_run();
+    if (alternation) {
+        regex.prefix.clear();
+        regex.literal.clear();
+    }
+
+    std::regex_constants::syntax_option_type flag = std::regex_constants::ECMAScript |
+                                                    std::regex_constants::nosubs;
+    if (icase)
+        flag |= std::regex_constants::icase;
+    try {
+        regex.regex.assign(str, flag);
+    } catch (const std::regex_error &e) {
+        return false;
+    }
+    return true;
 }
 
+// types converted to code points for std::wregex
+struct WideTypes {
+    Wchars chars;
+    std::vector<std::size_t> offsets;
+    std::vector<bool> ascii;
+    std::vector<bool> valid; // if FALSE, types are left to stringi
 
-Configs parse_patterns(Patterns patterns, bool glob = true) {
-    
-    Configs confs;
-    confs.reserve(patterns.size());
-    std::unordered_set<std::string> set_unique; 
-    
-    // for fixed
-    confs.push_back({0, "", 0});
-    if (!glob)
-        return confs;
-        
-    // for glob
-    for (size_t i = 0; i < patterns.size(); i++) {
-        
-        Config conf;
-        std::string pattern = patterns[i];
-        std::string left = utf8_sub_left(pattern, 1);
-        std::string right = utf8_sub_right(pattern, 1);
-        std::string key = ""; // for deduplication
-        int len;
-        
-        if ((left == "*" || left == "!") && (right == "*" || right == "!"))
-            continue;
-        if (left == "*") {
-            len = utf8_length(pattern) - 1;
-            key = "L*" + std::to_string(len);
-            conf = {1, "*", len};
-        } else if (right == "*") {
-            len = utf8_length(pattern) - 1;
-            key = "R*" + std::to_string(len);
-            conf = {2, "*", len};
-        } else if (left == "?") {
-            key = "L?";
-            conf = {1, "?", -1};
-        } else if (right == "?") {
-            key = "R?";
-            conf = {2, "?", -1};
-        }
-        
-        if (key != "") {
-            auto it = set_unique.find(key);
-            if (it == set_unique.end()) {
-                //Rcout << "Add: " << key << "\n";
-                set_unique.insert(key);
-                confs.push_back(conf);
+    WideTypes(const Types &types, const bool icase) {
+        std::size_t H = types.size();
+        std::size_t size = 0;
+        for (std::size_t h = 0; h < H; h++)
+            size += types[h].size();
+        chars.reserve(size);
+        offsets.reserve(H + 1);
+        offsets.push_back(0);
+        ascii.resize(H);
+        valid.resize(H);
+        for (std::size_t h = 0; h < H; h++) {
+            const Type &type = types[h];
+            ascii[h] = utf8_is_ascii(type.data(), type.size());
+            valid[h] = ascii[h] || utf8_valid(type.data(), type.size());
+            std::size_t i = 0, n;
+            if (ascii[h]) {
+                chars.insert(chars.end(), type.begin(), type.end());
+                i = type.size();
             }
+            while (valid[h] && i < type.size()) {
+                uint32_t c = utf8_decode(type.data() + i, type.size() - i, n);
+#if WCHAR_MAX <= 0xFFFF
+                if (c > 0xFFFF)
+                    valid[h] = false;
+#endif
+                if (icase && is_folded(c))
+                    valid[h] = false;
+                chars.push_back((wchar_t)c);
+                i += n;
+            }
+            if (chars.size() - offsets.back() > max_regex_length)
+                valid[h] = false;
+            if (!valid[h])
+                chars.resize(offsets.back());
+            offsets.push_back(chars.size());
         }
     }
-    
-    return confs;
+
+    bool match(std::size_t h, const std::wregex &regex) const {
+        const wchar_t *begin = chars.data() + offsets[h];
+        const wchar_t *end = chars.data() + offsets[h + 1];
+        return std::regex_search(begin, end, regex);
+    }
+};
+
+void index_regex(const Types &types, const WideTypes &wides, const Regex &regex,
+                 const SortedTypes &forward, TypeIds &result) {
+
+    // types are only matched if they start with the prefix
+    const int *ids = NULL;
+    std::size_t N = types.size();
+    if (!regex.prefix.empty() && !forward.ids.empty()) {
+        auto range = forward.find(regex.prefix);
+        ids = forward.ids.data() + (range.first - forward.ids.begin());
+        N = range.second - range.first;
+    }
+
+    std::vector<char> flags(N, false);
+    auto match = [&](std::size_t i) {
+        int h = ids ? ids[i] : i;
+        if (!wides.valid[h] || (regex.ascii && !wides.ascii[h]))
+            return;
+        const Type &type = types[h];
+        if (type.compare(0, regex.prefix.size(), regex.prefix) != 0)
+            return;
+        if (type.find(regex.literal) == std::string::npos)
+            return;
+        flags[i] = wides.match(h, regex.regex);
+    };
+#if QUANTEDA_USE_TBB
+    tbb::parallel_for(tbb::blocked_range<std::size_t>(0, N), [&](tbb::blocked_range<std::size_t> r) {
+        for (std::size_t i = r.begin(); i < r.end(); ++i) {
+            match(i);
+        }
+    });
+#else
+    for (std::size_t i = 0; i < N; i++) {
+        match(i);
+    }
+#endif
+    for (std::size_t i = 0; i < N; i++) {
+        if (flags[i])
+            result.push_back(ids ? ids[i] : i);
+    }
+    std::sort(result.begin(), result.end());
 }
 
+/*
+ * Function to find types that match regular expressions
+ * @used index_types()
+ * @param case_insensitive if TRUE, types must be lowercased
+ * @return a list of type IDs for each pattern with attributes; patterns that
+ *   cannot be translated are NULL; "fallback" are types that are not matched
+ *   in C++; "nonascii" are types that are not matched to patterns with "ascii"
+ */
+
 // [[Rcpp::export]]
-List cpp_index_types(const CharacterVector &patterns_, 
-                     const CharacterVector &types_, bool glob = true) {
-    
-    //dev::Timer timer;
-    //dev::start_timer("Convert", timer);
-    
+List cpp_index_regex(const CharacterVector &patterns_,
+                     const CharacterVector &types_,
+                     const bool case_insensitive = true,
+                     const int thread = -1) {
+
     Patterns patterns = Rcpp::as<Patterns>(patterns_);
     Types types = Rcpp::as<Types>(types_);
-    
-    MapIndex index;
-    for (size_t j = 0; j < patterns.size(); j++) {
-        index[patterns[j]].reserve(types.size());
-        //Rcout << "Register: " << patterns[j] << "\n";
+
+    // unique patterns compiled only once
+    std::unordered_map<Pattern, std::size_t> map_pattern;
+    std::vector<std::size_t> pos(patterns.size());
+    std::vector<Pattern> uniques;
+    for (std::size_t i = 0; i < patterns.size(); i++) {
+        auto it = map_pattern.insert(std::make_pair(patterns[i], map_pattern.size()));
+        if (it.second)
+            uniques.push_back(patterns[i]);
+        pos[i] = it.first->second;
+    }
+    std::size_t G = uniques.size();
+    std::vector<Regex> regexes(G);
+    std::vector<bool> flags_regex(G);
+    std::size_t n_prefix = 0;
+    for (std::size_t g = 0; g < G; g++) {
+        flags_regex[g] = !uniques[g].empty() && parse_regex(uniques[g], case_insensitive, regexes[g]);
+        if (flags_regex[g] && !regexes[g].prefix.empty())
+            n_prefix++;
     }
-    Configs confs = parse_patterns(patterns, glob);
 
-    //dev::stop_timer("Convert", timer);
-    
-    //dev::start_timer("Index", timer);
-    
-    std::size_t H = confs.size();
-    Texts temp(H);
+    WideTypes wides(types, case_insensitive);
+    std::size_t H = types.size();
+    std::size_t L = 1;
+    while (((std::size_t)1 << L) < H)
+        L++;
+    SortedTypes forward(types, false);
+    if (n_prefix > L)
+        forward.sort();
+
+    std::vector<TypeIds> temp(G);
 #if QUANTEDA_USE_TBB
-    tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-        for (int h = r.begin(); h < r.end(); ++h) {
-            index_types(types, index, confs[h]);
-        }
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, G), [&](tbb::blocked_range<int> r) {
+            for (int g = r.begin(); g < r.end(); ++g) {
+                if (flags_regex[g])
+                    index_regex(types, wides, regexes[g], forward, temp[g]);
+            }
+        });
     });
 #else
-    for (size_t h = 0; h < H; h++) {
-        index_types(types, index, confs[h]);
+    for (std::size_t g = 0; g < G; g++) {
+        if (flags_regex[g])
+            index_regex(types, wides, regexes[g], forward, temp[g]);
     }
 #endif
-    //dev::stop_timer("Index", timer);
 
-    //dev::start_timer("List", timer);
     List result_(patterns.size());
+    LogicalVector ascii_(patterns.size());
     for (size_t i = 0; i < patterns.size(); i++) {
-        std::string pattern = patterns[i];
-        IntegerVector value_ = Rcpp::wrap(index[pattern]);
-        result_[i] = sort_unique(value_) + 1; // R is 1 base
+        std::size_t g = pos[i];
+        ascii_[i] = flags_regex[g] && regexes[g].ascii;
+        if (!flags_regex[g])
+            continue;
+        IntegerVector value_ = Rcpp::wrap(temp[g]);
+        result_[i] = value_ + 1; // R is 1 base
+    }
+    TypeIds fallback, nonascii;
+    for (std::size_t h = 0; h < H; h++) {
+        if (!wides.valid[h]) {
+            fallback.push_back(h + 1);
+        } else if (!wides.ascii[h]) {
+            nonascii.push_back(h + 1);
+        }
     }
     result_.attr("names") = encode(patterns);
-    //dev::stop_timer("List", timer);
-    
+    result_.attr("ascii") = ascii_;
+    result_.attr("fallback") = Rcpp::wrap(fallback);
+    result_.attr("nonascii") = Rcpp::wrap(nonascii);
     return result_;
 }
 
 /*** R
-#out <- cpp_index_types(c("a*", "*b", "*c*", "跩*"), 
+#out <- cpp_index_types(c("a*", "*b", "*c*", "跩*"),
 #                       c("bbb", "aaa", "跩购鹇", "ccc", "aa", "bb"))
 cpp_index_types(c("跩", "跩*"), c("跩购鹇", "跩"))
+cpp_index_types(c("*购*", "跩?鹇", "?购*"), c("跩购鹇", "跩", "购"))
+cpp_index_regex(c("^跩", "购$", "\\d"), c("跩购鹇", "跩", "购", "1"))
 */
@@ -1,80 +1,105 @@
 #include "lib.h"
+#include "serialize.h"
 //#include "dev.h"
 using namespace quanteda;
 
-typedef std::vector<std::string> StringText;
+// pointers to CHARSXPs of tokens in a document
+typedef std::pair<const SEXP*, std::size_t> StringText;
 typedef std::vector<StringText> StringTexts;
-#if QUANTEDA_USE_TBB
-typedef tbb::concurrent_unordered_map<std::string, UintParam> MapTypes;
-#else
-typedef std::unordered_map<std::string, unsigned int> MapTypes;
-#endif
 
-Text serialize(const StringText &text, 
-               MapTypes &map, 
-               UintParam &id,
-               bool padding) {
-    std::size_t I = text.size();
-    Text temp;
-    temp.reserve(I);
-    for (size_t i = 0; i < I; i++) {
-        if (text[i] == "") {
-            if (padding) {
-                temp.push_back(0);
-            } else {
+// identical strings usually share CHARSXPs in R's global cache
+struct hash_charsxp_ptr {
+    std::size_t operator() (SEXP str) const {
+        return mix_hash((uint64_t)(uintptr_t)str);
+    }
+};
+typedef std::unordered_map<SEXP, unsigned int, hash_charsxp_ptr> MapPointer;
+typedef std::unordered_map<SEXP, Chars, hash_charsxp_ptr> MapCharsxp;
+
+// convert tokens to local IDs ignoring paddings; strings are compared only
+// when their pointers are not found because they can be in different CHARSXPs
+// if their encodings are different; CHARSXPs are only used as keys because
+// R's API must not be called in this function
+void serialize_block(const StringTexts &texts, const MapCharsxp &strings,
+                     Texts &temp, Block &block) {
+    MapPointer map_ptr;
+    MapChars map;
+    for (std::size_t h = block.begin; h < block.end; h++) {
+        const SEXP *text = texts[h].first;
+        std::size_t I = texts[h].second;
+        Text &text_temp = temp[h];
+        text_temp.reserve(I);
+        for (std::size_t i = 0; i < I; i++) {
+            SEXP token = text[i];
+            auto it = map_ptr.find(token);
+            if (it != map_ptr.end()) {
+                if (it->second > 0)
+                    text_temp.push_back(it->second);
                 continue;
             }
-        } else {
-            auto it1 = map.find(text[i]);
-            if (it1 != map.end()) {
-                temp.push_back(it1->second);
-            } else {
-#if QUANTEDA_USE_TBB
-                auto it2 = map.insert(std::pair<std::string, UintParam>(text[i], id.fetch_and_increment()));
-#else
-                auto it2 = map.insert(std::pair<std::string, UintParam>(text[i], id++));
-#endif
-                temp.push_back(it2.first->second);
+            unsigned int id = 0;
+            const Chars &str = strings.find(token)->second;
+            if (str.len > 0) {
+                id = local_id(block, map, str);
+                text_temp.push_back(id);
             }
+            map_ptr.insert(std::make_pair(token, id)); // zero for paddings
         }
     }
-    return temp;
 }
 
+// serialize documents registering new types to map and types
+Texts serialize(const StringTexts &texts, const MapCharsxp &strings,
+                MapTypes &map, Types &types, const int thread) {
+    return serialize_blocks(texts.size(), [&](Texts &temp, Block &block) {
+        serialize_block(texts, strings, temp, block);
+    }, map, types, thread);
+}
+
+// get pointers to tokens and their characters in the main thread; vectors
+// that are not character are converted and kept in temp_
+StringTexts as_string_texts(const List &texts_, std::vector<CharacterVector> &temp_,
+                            MapCharsxp &strings) {
+    std::size_t H = texts_.size();
+    StringTexts texts(H);
+    for (std::size_t h = 0; h < H; h++) {
+        SEXP text_ = texts_[h];
+        if (TYPEOF(text_) == NILSXP) {
+            texts[h] = StringText(NULL, 0);
+            continue;
+        }
+        if (TYPEOF(text_) != STRSXP) {
+            temp_.push_back(CharacterVector(text_));
+            text_ = temp_.back();
+        }
+        const SEXP *text = STRING_PTR_RO(text_);
+        std::size_t I = XLENGTH(text_);
+        texts[h] = StringText(text, I);
+        // each CHARSXP is resolved only once
+        SEXP last = NULL;
+        for (std::size_t i = 0; i < I; i++) {
+            SEXP token = text[i];
+            if (token == last)
+                continue;
+            last = token;
+            if (strings.find(token) == strings.end())
+                strings.insert(std::make_pair(token, Chars{CHAR(token), (std::size_t)LENGTH(token)}));
+        }
+    }
+    return texts;
+}
 
 // [[Rcpp::export]]
 TokensPtr cpp_serialize(List texts_, 
                         const int thread = -1) {
     
-    //dev::Timer timer;
-    StringTexts texts = Rcpp::as<StringTexts>(texts_);
+    std::vector<CharacterVector> temp_;
+    MapCharsxp strings;
+    StringTexts texts = as_string_texts(texts_, temp_, strings);
     MapTypes map;
-    
-    //dev::start_timer("Serialize", timer);
-    UintParam id = 1;
-    std::size_t H = texts.size();
-    Texts temp(H);
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                temp[h] = serialize(texts[h], map, id, false);
-            }    
-        });
-    });
-#else
-    for (std::size_t h = 0; h < H; h++) {
-        temp[h] = serialize(texts[h], map, id, false);
-    }
-#endif
-    
-    Types types(id - 1);
-    for (std::pair<std::string, unsigned int> it : map) {
-        types[it.second - 1] = it.first;
-    }
-    //dev::stop_timer("Serialize", timer);
-    TokensObj *ptr = new TokensObj(temp, types);
+    Types types;
+    Texts temp = serialize(texts, strings, map, types, thread);
+    TokensObj *ptr = new TokensObj(std::move(temp), std::move(types));
     return TokensPtr(ptr, true);
 }
 
@@ -83,45 +108,22 @@ TokensPtr cpp_serialize_add(List texts_,
                             TokensPtr xptr,
                             const int thread = -1) {
     
-    //dev::Timer timer;
-    Types types = xptr->types;
-    StringTexts texts = Rcpp::as<StringTexts>(texts_);
-    
-    //dev::start_timer("Register", timer);
-    MapTypes map;
-    for (std::size_t g = 0; g < types.size(); g++) {
-        std::string type = types[g];
-        map.insert(std::pair<std::string, UintParam>(types[g], g + 1));
-    }
-    //dev::stop_timer("Register", timer);
-    
-    //dev::start_timer("Serialize", timer);
-    UintParam id = types.size() + 1;
-    std::size_t H = texts.size();
-    Texts temp(H);
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                temp[h] = serialize(texts[h], map, id, false);
-            }    
-        });
-    });
-#else
-    for (size_t h = 0; h < H; h++) {
-        temp[h] = serialize(texts[h], map, id, false);
-    }
-#endif
-    
-    Types types_new(id - 1);
-    for (std::pair<std::string, unsigned int> it : map) {
-        types_new[it.second - 1] = it.first;
-    }
-    //dev::stop_timer("Serialize", timer);
+    std::vector<CharacterVector> temp_;
+    MapCharsxp strings;
+    StringTexts texts = as_string_texts(texts_, temp_, strings);
+    TokensObj &obj = *xptr;
+    // the dictionary is kept in the object for the next call
+    MapTypes &map = obj.get_dictionary();
+    Types &types = obj.append_types();
+    Texts temp = serialize(texts, strings, map, types, thread);
+    obj.add_texts(std::move(temp));
+    return xptr;
+}
 
-    xptr->texts.insert(xptr->texts.end(), temp.begin(), temp.end());
-    xptr->types = types_new;
+// free the dictionary kept by cpp_serialize_add() and cpp_tokenize_add()
+// [[Rcpp::export]]
+TokensPtr cpp_drop_dictionary(TokensPtr xptr) {
+    xptr->drop_dictionary();
     return xptr;
 }
 
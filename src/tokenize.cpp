@@ -0,0 +1,395 @@
+#include "lib.h"
+#include "serialize.h"
+#include "utf8.h"
+#include <fstream>
+//#include "dev.h"
+using namespace quanteda;
+
+// characters of documents
+typedef std::vector<Chars> CharTexts;
+
+// separators (\p{Z}) and other characters (\p{C}) except unassigned code points,
+// which depend on the version of Unicode
+inline bool is_separator(uint32_t c) {
+    if (c < 0x80)
+        return c <= 0x20 || c == 0x7F;
+    if (c <= 0xA0 || c == 0xAD)
+        return true;
+    if (c < 0x0600)
+        return false;
+    if (c < 0x2000)
+        return (0x0600 <= c && c <= 0x0605) || c == 0x061C || c == 0x06DD ||
+               c == 0x070F || c == 0x0890 || c == 0x0891 || c == 0x08E2 ||
+               c == 0x1680 || c == 0x180E;
+    if (c < 0x3000)
+        return c <= 0x200F || (0x2028 <= c && c <= 0x202F) ||
+               (0x205F <= c && c <= 0x2064) || (0x2066 <= c && c <= 0x206F);
+    if (c < 0x10000)
+        return c == 0x3000 || (0xD800 <= c && c <= 0xF8FF) || c == 0xFEFF ||
+               (0xFFF9 <= c && c <= 0xFFFB);
+    return c == 0x110BD || c == 0x110CD || (0x13430 <= c && c <= 0x1343F) ||
+           (0x1BCA0 <= c && c <= 0x1BCA3) || (0x1D173 <= c && c <= 0x1D17A) ||
+           c == 0xE0001 || (0xE0020 <= c && c <= 0xE007F) ||
+           (0xF0000 <= c && c <= 0xFFFFD) || (0x100000 <= c && c <= 0x10FFFD);
+}
+
+// split documents into tokens and convert them to local IDs without copying
+void tokenize_block(const CharTexts &texts, Texts &temp, Block &block,
+                    const bool fastest) {
+    MapChars map;
+    for (std::size_t h = block.begin; h < block.end; h++) {
+        const char *str = texts[h].ptr;
+        std::size_t len = texts[h].len;
+        Text &text_temp = temp[h];
+        std::size_t i = 0, j = 0; // current position and beginning of a token
+        while (i < len) {
+            std::size_t n = 1;
+            if (fastest) {
+                const char *p = (const char*)std::memchr(str + i, ' ', len - i);
+                if (p == NULL)
+                    break;
+                i = p - str;
+            } else {
+                // printable ASCII characters are never separators
+                i += utf8_ascii_graph(str + i, len - i);
+                if (i == len)
+                    break;
+                if (!is_separator(utf8_decode(str + i, len - i, n))) {
+                    i += n;
+                    continue;
+                }
+            }
+            if (i > j)
+                text_temp.push_back(local_id(block, map, Chars{str + j, i - j}));
+            i += n;
+            j = i;
+        }
+        if (len > j)
+            text_temp.push_back(local_id(block, map, Chars{str + j, len - j}));
+    }
+}
+
+/*
+ * Function to tokenize texts and add them to tokens_xptr
+ * @used tokens()
+ * @param texts_ texts in UTF-8; missing values are empty documents
+ * @param fastest if TRUE, split only on the space character as
+ *   tokenize_fastestword(); otherwise on separators and other characters as
+ *   tokenize_fasterword()
+ */
+
+// [[Rcpp::export]]
+TokensPtr cpp_tokenize_add(const CharacterVector &texts_,
+                           TokensPtr xptr,
+                           const bool fastest = false,
+                           const int thread = -1) {
+
+    // characters are taken in the main thread
+    std::size_t H = texts_.size();
+    CharTexts texts(H);
+    for (std::size_t h = 0; h < H; h++) {
+        SEXP text_ = STRING_ELT(texts_, h);
+        if (text_ == NA_STRING) {
+            texts[h] = Chars{NULL, 0};
+        } else {
+            texts[h] = Chars{CHAR(text_), (std::size_t)LENGTH(text_)};
+        }
+    }
+
+    TokensObj &obj = *xptr;
+    MapTypes &map = obj.get_dictionary();
+    Types &types = obj.append_types();
+    Texts temp = serialize_blocks(H, [&](Texts &temp, Block &block) {
+        tokenize_block(texts, temp, block, fastest);
+    }, map, types, thread);
+    obj.add_texts(std::move(temp));
+    return xptr;
+}
+
+inline void skip_space(const char *&p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+}
+
+inline uint32_t parse_hex(const char *&p, const char *end) {
+    if (end - p < 4)
+        throw std::range_error("Invalid JSON");
+    uint32_t c = 0;
+    for (int k = 0; k < 4; k++, p++) {
+        c <<= 4;
+        if ('0' <= *p && *p <= '9') {
+            c |= *p - '0';
+        } else if ('a' <= *p && *p <= 'f') {
+            c |= *p - 'a' + 10;
+        } else if ('A' <= *p && *p <= 'F') {
+            c |= *p - 'A' + 10;
+        } else {
+            throw std::range_error("Invalid JSON");
+        }
+    }
+    return c;
+}
+
+// parse a JSON string and decode it to str unless str is NULL; null characters
+// and unpaired surrogates are rejected as they cannot be in strings of R
+void parse_string(const char *&p, const char *end, std::string *str) {
+    if (p >= end || *p != '"')
+        throw std::range_error("Invalid JSON");
+    p++;
+    while (p < end) {
+        char c = *p++;
+        if (c == '"')
+            return;
+        if (c != '\\') {
+            if (str) {
+                if (c == '\0')
+                    throw std::range_error("Invalid JSON");
+                str->push_back(c);
+            }
+            continue;
+        }
+        if (p >= end)
+            break;
+        c = *p++;
+        uint32_t u;
+        switch (c) {
+        case '"': case '\\': case '/': break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+            u = parse_hex(p, end);
+            if (0xD800 <= u && u <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                const char *q = p + 2;
+                uint32_t v = parse_hex(q, end);
+                if (0xDC00 <= v && v <= 0xDFFF) {
+                    u = 0x10000 + ((u - 0xD800) << 10) + (v - 0xDC00);
+                    p = q;
+                }
+            }
+            if (str) {
+                if (u == 0 || (0xD800 <= u && u <= 0xDFFF))
+                    throw std::range_error("Invalid JSON");
+                utf8_encode(u, *str);
+            }
+            continue;
+        default:
+            throw std::range_error("Invalid JSON");
+        }
+        if (str) str->push_back(c);
+    }
+    throw std::range_error("Invalid JSON");
+}
+
+// parse a JSON value and copy it to str if it is a string or a scalar other
+// than null; objects and arrays are skipped
+bool parse_value(const char *&p, const char *end, std::string *str) {
+    skip_space(p, end);
+    if (p >= end)
+        throw std::range_error("Invalid JSON");
+    if (*p == '"') {
+        if (str) str->clear();
+        parse_string(p, end, str);
+        return true;
+    }
+    if (*p == '{' || *p == '[') {
+        std::size_t depth = 0;
+        while (p < end) {
+            if (*p == '"') {
+                parse_string(p, end, NULL);
+                continue;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if (*p == '}' || *p == ']') {
+                if (--depth == 0) {
+                    p++;
+                    return false;
+                }
+            }
+            p++;
+        }
+        throw std::range_error("Invalid JSON");
+    }
+    const char *begin = p;
+    while (p < end && *p != ',' && *p != '}' && *p != ']' && 
+           *p != ' ' && *p != '\t' && *p != '\r')
+        p++;
+    if (p == begin)
+        throw std::range_error("Invalid JSON");
+    if (std::string(begin, p) == "null")
+        return false;
+    if (str) str->assign(begin, p);
+    return true;
+}
+
+// get values of fields from a JSON object in a line
+void parse_object(const char *p, const char *end,
+                  const std::string &text_field, std::string &text, 
+                  const std::string &docid_field, std::string &docid, bool &has_docid) {
+    skip_space(p, end);
+    if (p >= end || *p != '{')
+        throw std::range_error("Invalid JSON");
+    p++;
+    skip_space(p, end);
+    if (p < end && *p == '}')
+        return;
+    std::string key;
+    while (p < end) {
+        skip_space(p, end);
+        key.clear();
+        parse_string(p, end, &key);
+        skip_space(p, end);
+        if (p >= end || *p != ':')
+            throw std::range_error("Invalid JSON");
+        p++;
+        if (key == text_field) {
+            if (!parse_value(p, end, &text))
+                text.clear();
+        } else if (!docid_field.empty() && key == docid_field) {
+            has_docid = parse_value(p, end, &docid);
+        } else {
+            parse_value(p, end, NULL);
+        }
+        skip_space(p, end);
+        if (p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        if (p < end && *p == '}')
+            return;
+        break;
+    }
+    throw std::range_error("Invalid JSON");
+}
+
+/*
+ * Function to tokenize texts in a file and add them to tokens_xptr
+ * @used read_tokens_xptr()
+ * @param jsonl if TRUE, each line is a JSON object; otherwise each line is a 
+ *   document
+ * @param text_field_ name of the field of texts in JSON objects
+ * @param docid_field_ name of the field of document names in JSON objects; 
+ *   ignored if empty
+ * @param chunk_size number of bytes read at once; a line longer than this is
+ *   read to its end
+ * @return a list of the object and document names; missing names are NA
+ */
+
+// [[Rcpp::export]]
+List cpp_tokenize_file(const String &file_,
+                       TokensPtr xptr,
+                       const bool jsonl = false,
+                       const String &text_field_ = "text",
+                       const String &docid_field_ = "",
+                       const bool fastest = false,
+                       const double chunk_size = 67108864,
+                       const int thread = -1) {
+    
+    std::ifstream in(file_.get_cstring(), std::ios::binary);
+    if (!in)
+        throw std::range_error("Cannot open the file to read");
+    if (chunk_size < 1)
+        throw std::range_error("Invalid chunk size");
+    
+    std::string text_field = text_field_;
+    std::string docid_field = docid_field_;
+    std::size_t size = chunk_size;
+    TokensObj &obj = *xptr;
+    MapTypes &map = obj.get_dictionary();
+    Types &types = obj.append_types();
+    std::vector<std::string> docids;
+    std::vector<bool> has_docids;
+    
+    std::string buffer; // chunk and incomplete line left from the last chunk
+    std::vector<std::string> strs; // texts decoded from JSON
+    std::size_t n = 0; // line number
+    bool first = true;
+    while (true) {
+        std::size_t rest = buffer.size();
+        buffer.resize(rest + size);
+        in.read(&buffer[rest], size);
+        buffer.resize(rest + in.gcount());
+        bool eof = !in;
+        if (first) {
+            if (buffer.size() < 3 && !eof)
+                continue;
+            if (buffer.compare(0, 3, "\xEF\xBB\xBF") == 0)
+                buffer.erase(0, 3); // byte-order mark
+            first = false;
+        }
+        
+        // only complete lines are processed until the end of the file
+        std::size_t last = eof ? buffer.size() : buffer.rfind('\n');
+        if (last == std::string::npos)
+            continue;
+        
+        CharTexts texts;
+        strs.clear();
+        const char *data = buffer.data();
+        std::size_t i = 0;
+        while (i < last || (i == last && !eof)) {
+            std::size_t j = buffer.find('\n', i);
+            if (j == std::string::npos || j > last)
+                j = last;
+            std::size_t k = j;
+            if (k > i && data[k - 1] == '\r')
+                k--;
+            n++;
+            if (!jsonl) {
+                texts.push_back(Chars{data + i, k - i});
+            } else {
+                const char *p = data + i;
+                skip_space(p, data + k);
+                if (p < data + k) {
+                    std::string str, docid;
+                    bool has_docid = false;
+                    try {
+                        parse_object(p, data + k, text_field, str, 
+                                     docid_field, docid, has_docid);
+                    } catch (std::range_error &e) {
+                        throw std::range_error("Invalid JSON in line " + std::to_string(n));
+                    }
+                    strs.push_back(std::move(str));
+                    docids.push_back(std::move(docid));
+                    has_docids.push_back(has_docid);
+                }
+            }
+            i = j + 1;
+            if (j == last)
+                break;
+        }
+        for (std::size_t h = 0; h < strs.size(); h++)
+            texts.push_back(Chars{strs[h].data(), strs[h].size()});
+        
+        Texts temp = serialize_blocks(texts.size(), [&](Texts &temp, Block &block) {
+            tokenize_block(texts, temp, block, fastest);
+        }, map, types, thread);
+        obj.add_texts(std::move(temp));
+        
+        buffer.erase(0, std::min(last + 1, buffer.size()));
+        if (eof)
+            break;
+    }
+    if (in.bad())
+        throw std::range_error("Cannot read the file");
+    obj.drop_dictionary(); // only used while the file is read
+    
+    CharacterVector docids_(docid_field.empty() ? 0 : docids.size());
+    for (std::size_t h = 0; h < (std::size_t)docids_.size(); h++) {
+        if (has_docids[h]) {
+            docids_[h] = Rf_mkCharLenCE(docids[h].c_str(), docids[h].size(), CE_UTF8);
+        } else {
+            docids_[h] = NA_STRING;
+        }
+    }
+    return List::create(xptr, docids_);
+}
+
+/***R
+xtoks <- cpp_serialize(list())
+xtoks <- cpp_tokenize_add(c("a b  c", "\tb c　d"), xtoks)
+quanteda:::cpp_get_attributes(xtoks)
+*/
@@ -2,7 +2,7 @@
 //#include "dev.h"
 using namespace quanteda;
 
-Texts chunk(Text &tokens,
+Texts chunk(const TextView &tokens,
             UintParam &N,
             const int size,
             const int overlap){
@@ -36,24 +36,23 @@ TokensPtr cpp_tokens_chunk(TokensPtr xptr,
                            const int overlap,
                            const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    const TokensObj &obj = *xptr;
     UintParam N = 0;
     // dev::Timer timer;
-    std::size_t H = texts.size();
-    std::vector<Texts> temp(texts.size());
+    std::size_t H = obj.size();
+    std::vector<Texts> temp(H);
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
          for (int h = r.begin(); h < r.end(); ++h) {
-             temp[h] = chunk(texts[h], N, size, overlap);
+             temp[h] = chunk(obj.text(h), N, size, overlap);
          }    
         });
     });
 #else
     for (std::size_t h = 0; h < H; h++) {
-        temp[h] = chunk(texts[h], N, size, overlap);
+        temp[h] = chunk(obj.text(h), N, size, overlap);
     }
 #endif
     
@@ -69,7 +68,10 @@ TokensPtr cpp_tokens_chunk(TokensPtr xptr,
         }
     }
     
-    TokensObj *ptr_new = new TokensObj(chunks, xptr->types, xptr->recompiled);
+    TokensObj *ptr_new = new TokensObj(std::move(chunks), Types(), xptr->recompiled);
+    ptr_new->share_types(*xptr);
+    ptr_new->set_flat(xptr->flat);
+    ptr_new->set_compact(xptr->compact);
     TokensPtr xptr_new = TokensPtr(ptr_new, true);
     
     IntegerVector documents_ = Rcpp::wrap(documents);
@@ -15,42 +15,55 @@ TokensPtr cpp_tokens_combine(TokensPtr xptr1,
                              TokensPtr xptr2,
                              const int thread = -1) {
     
+    const TokensObj &obj1 = *xptr1;
+    const TokensObj &obj2 = *xptr2;
+    const Types &types1 = obj1.get_types();
+    const Types &types2 = obj2.get_types();
     Types types;
-    types.reserve(xptr1->types.size() + xptr2->types.size());
-    types.insert(types.end(), xptr1->types.begin(), xptr1->types.end());
-    types.insert(types.end(), xptr2->types.begin(), xptr2->types.end());
+    types.reserve(types1.size() + types2.size());
+    types.insert(types.end(), types1.begin(), types1.end());
+    types.insert(types.end(), types2.begin(), types2.end());
     
-    std::size_t V = xptr1->types.size();
-    std::size_t H = xptr2->texts.size(); 
-    Texts texts = xptr2->texts;
+    std::size_t V = types1.size();
+    std::size_t H1 = obj1.size(); 
+    std::size_t H = obj2.size(); 
+    Texts texts(H1 + H);
+    for (std::size_t h = 0; h < H1; h++) {
+        TextView text = obj1.text(h);
+        texts[h] = Text(text.begin(), text.end());
+    }
     
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
             for (int h = r.begin(); h < r.end(); ++h) {
-                for (std::size_t i = 0; i < texts[h].size(); i++) {
-                    if (texts[h][i] != 0)
-                        texts[h][i] += V;
+                TextView text = obj2.text(h);
+                Text &text_new = texts[H1 + h];
+                text_new.assign(text.begin(), text.end());
+                for (std::size_t i = 0; i < text_new.size(); i++) {
+                    if (text_new[i] != 0)
+                        text_new[i] += V;
                 }
             }
         });
     });
 #else
     for (std::size_t h = 0; h < H; h++) {
-        for (std::size_t i = 0; i < texts[h].size(); i++) {
-            if (texts[h][i] != 0)
-                texts[h][i] += V;
+        TextView text = obj2.text(h);
+        Text &text_new = texts[H1 + h];
+        text_new.assign(text.begin(), text.end());
+        for (std::size_t i = 0; i < text_new.size(); i++) {
+            if (text_new[i] != 0)
+                text_new[i] += V;
         }
     }
 #endif
-
-    Texts temp;
-    temp.reserve(xptr1->texts.size() + texts.size());
-    temp.insert(temp.end(), xptr1->texts.begin(), xptr1->texts.end());
-    temp.insert(temp.end(), texts.begin(), texts.end());
     
-    TokensObj *ptr = new TokensObj(temp, types, false);
+    TokensObj *ptr = new TokensObj(Texts(), std::move(types), false);
+    ptr->set_flat(obj1.flat);
+    ptr->set_compact(obj1.compact);
+    ptr->set_texts(std::move(texts));
     return TokensPtr(ptr, true);
 }
 
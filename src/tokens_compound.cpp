@@ -1,9 +1,10 @@
 #include "lib.h"
+#include "automaton.h"
 #include "skipgram.h"
 //#include "dev.h"
 using namespace quanteda;
 
-int adjust_window(Text &tokens, int current, int end) {
+int adjust_window(const TextView &tokens, int current, int end) {
     int i = current; 
     if (end < current) {
         while (i - 1 >= 0 && i - 1 >= end && tokens[i - 1] != 0) i--;
@@ -13,9 +14,16 @@ int adjust_window(Text &tokens, int current, int end) {
     return(i);
 }
 
-Text join_comp(Text tokens, 
-               const std::vector<std::size_t> &spans,
-               const SetNgrams &set_comps,
+// ignore patterns with paddings and single tokens without windows
+bool ignore(const TextView &tokens, const Hit &hit, const std::pair<int, int> &window) {
+    if (hit.span == 1 && window.first == 0 && window.second == 0)
+        return true;
+    return std::find(tokens.begin() + hit.pos, tokens.begin() + hit.pos + hit.span, 0) != 
+           tokens.begin() + hit.pos + hit.span;
+}
+
+Text join_comp(const TextView &tokens, 
+               const Automaton &automaton,
                MapNgrams &map_comps,
                IdNgram &id_comp,
                const std::pair<int, int> &window){
@@ -25,23 +33,19 @@ Text join_comp(Text tokens,
     std::vector< bool > flags_link(tokens.size(), false); // flag tokens to join
     std::size_t match = 0;
     
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (std::size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto it = set_comps.find(ngram);
-            if (it != set_comps.end()) {
-                // Adjust window size to exclude padding
-                int from = adjust_window(tokens, i, i - window.first);
-                int to = adjust_window(tokens, i, i + span + window.second);
-                std::fill(flags_link.begin() + from, flags_link.begin() + to, true); // mark tokens linked
-                match++;
-            }
-            flags_link.back() = false; // last value should be false
-        }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        if (ignore(tokens, hit, window)) continue;
+        // Adjust window size to exclude padding
+        int from = adjust_window(tokens, i, i - window.first);
+        int to = adjust_window(tokens, i, i + span + window.second);
+        std::fill(flags_link.begin() + from, flags_link.begin() + to, true); // mark tokens linked
+        match++;
     }
+    flags_link.back() = false; // last value should be false
     
-    if (match == 0) return tokens; // return original tokens if no match
+    if (match == 0) return Text(tokens.begin(), tokens.end()); // return original tokens if no match
     
     Text tokens_flat;
     tokens_flat.reserve(tokens.size());
@@ -69,9 +73,8 @@ Text join_comp(Text tokens,
     return tokens_flat;
 }
 
-Text match_comp(Text tokens, 
-                const std::vector<std::size_t> &spans,
-                const SetNgrams &set_comps,
+Text match_comp(const TextView &tokens, 
+                const Automaton &automaton,
                 MapNgrams &map_comps,
                 IdNgram &id_comp,
                 const std::pair<int, int> &window){
@@ -81,27 +84,23 @@ Text match_comp(Text tokens,
     std::vector< std::vector<unsigned int> > tokens_multi(tokens.size()); 
     std::vector< bool > flags_match(tokens.size(), false); // flag matched tokens
     std::vector< bool > flags_link(tokens.size(), false); // flag tokens to join
+    Ngram tokens_seq; // reuse the buffer to avoid allocation
     std::size_t match = 0;
 
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (std::size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            //if (!nested && flags_link[i]) continue; // ignore matched tokens 
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto it = set_comps.find(ngram);
-            if (it != set_comps.end()) {
-                // Adjust window size to exclude padding
-                int from = adjust_window(tokens, i, i - window.first);
-                int to = adjust_window(tokens, i, i + span + window.second);
-                std::fill(flags_match.begin() + from, flags_match.begin() + to + 1, true); // mark tokens matched
-                Ngram tokens_seq(tokens.begin() + from, tokens.begin() + to + 1); // extract tokens matched
-                tokens_multi[i].push_back(ngram_id(tokens_seq, map_comps, id_comp)); // assign ID to ngram
-                match++;
-            }
-        }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        if (ignore(tokens, hit, window)) continue;
+        // Adjust window size to exclude padding
+        int from = adjust_window(tokens, i, i - window.first);
+        int to = adjust_window(tokens, i, i + span + window.second);
+        std::fill(flags_match.begin() + from, flags_match.begin() + to + 1, true); // mark tokens matched
+        tokens_seq.assign(tokens.begin() + from, tokens.begin() + to + 1); // extract tokens matched
+        tokens_multi[i].push_back(ngram_id(tokens_seq, map_comps, id_comp)); // assign ID to ngram
+        match++;
     }
     
-    if (match == 0) return tokens; // return original tokens if no match
+    if (match == 0) return Text(tokens.begin(), tokens.end()); // return original tokens if no match
     
     // Add original tokens that did not match
     for (std::size_t i = 0; i < tokens.size(); i++) {
@@ -143,8 +142,10 @@ TokensPtr cpp_tokens_compound(TokensPtr xptr,
                               int window_right,
                               const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    TokensObj &obj = *xptr;
+    Automaton automaton_temp; // for matching
+    const Automaton &automaton = get_patterns(compounds_, obj, automaton_temp);
+    Types &types = obj.mutable_types();
     std::string delim = delim_;
     std::pair<int, int> window(window_left, window_right);
 
@@ -155,50 +156,19 @@ TokensPtr cpp_tokens_compound(TokensPtr xptr,
     IdNgram id_comp = id_last + 1;
 #endif
 
-    SetNgrams set_comps; // for matching
-    set_comps.max_load_factor(GLOBAL_PATTERN_MAX_LOAD_FACTOR);
     MapNgrams map_comps; // for ID generation
     map_comps.max_load_factor(GLOBAL_NGRAMS_MAX_LOAD_FACTOR);
 
-    Ngrams comps = Rcpp::as<Ngrams>(compounds_);
-    std::vector<std::size_t> spans(comps.size());
-    for (size_t g = 0; g < comps.size(); g++) {
-        Ngram comp = comps[g];
-        // ignore patterns with paddings
-        if (std::find(comp.begin(), comp.end(), 0) == comp.end()) {
-            set_comps.insert(comp);
-            spans[g] = comp.size();
-        }
-    }
-    sort(spans.begin(), spans.end());
-    spans.erase(unique(spans.begin(), spans.end()), spans.end());
-    std::reverse(std::begin(spans), std::end(spans));
      
     // dev::Timer timer;
     // dev::start_timer("Token compound", timer);
-    std::size_t H = texts.size();
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                if (join) {
-                    texts[h] = join_comp(texts[h], spans, set_comps, map_comps, id_comp, window);
-                } else {
-                    texts[h] = match_comp(texts[h], spans, set_comps, map_comps, id_comp, window);
-                }
-            }    
-        });
-    });
-#else
-    for (std::size_t h = 0; h < H; h++) {
+    obj.transform([&](std::size_t h) -> Text {
         if (join) {
-            texts[h] = join_comp(texts[h], spans, set_comps, map_comps, id_comp, window);
+            return join_comp(obj.text(h), automaton, map_comps, id_comp, window);
         } else {
-            texts[h] = match_comp(texts[h], spans, set_comps, map_comps, id_comp, window);
+            return match_comp(obj.text(h), automaton, map_comps, id_comp, window);
         }
-    }
-#endif
+    }, thread);
 
     // Extract only keys in order of the ID
     VecNgrams ids_comp(id_comp - id_last - 1);
@@ -214,11 +184,10 @@ TokensPtr cpp_tokens_compound(TokensPtr xptr,
     for (std::size_t i = 0; i < ids_comp.size(); i++) {
         types_comp[i] = join_strings(ids_comp[i], types, delim);
     }
-    types.insert(types.end(), types_comp.begin(), types_comp.end());
+    types.insert(types.end(), std::make_move_iterator(types_comp.begin()), 
+                 std::make_move_iterator(types_comp.end()));
     
     // dev::stop_timer("Token compound", timer);
-    xptr->texts = texts;
-    xptr->types = types;
     xptr->recompiled = false;
     return xptr;
 }
@@ -19,12 +19,12 @@ TokensPtr cpp_tokens_group(TokensPtr xptr,
                            List groups_,
                            const int thread = -1) {
     
-    Texts texts = xptr->texts;
+    const TokensObj &obj = *xptr;
     Groups groups = Rcpp::as<Groups>(groups_);
 
     // pre-allocate memory
     std::size_t G = groups.size();
-    std::size_t H = texts.size();
+    std::size_t H = obj.size();
     std::vector<size_t> sizes(G);
     
     Texts temp(G);
@@ -33,7 +33,7 @@ TokensPtr cpp_tokens_group(TokensPtr xptr,
         for (int h: groups[g]) {
             if (h < 1 || H < h)
                 throw std::range_error("Invalid groups");
-            size += texts[h - 1].size();
+            size += obj.ntoken(h - 1);
         }
         temp[g].reserve(size);  
     }
@@ -44,7 +44,8 @@ TokensPtr cpp_tokens_group(TokensPtr xptr,
        tbb::parallel_for(tbb::blocked_range<int>(0, G), [&](tbb::blocked_range<int> r) {
           for (int g = r.begin(); g < r.end(); ++g) {
               for (std::size_t h: groups[g]) {
-                  temp[g].insert(temp[g].end(), texts[h - 1].begin(), texts[h - 1].end());
+                  TextView text = obj.text(h - 1);
+                  temp[g].insert(temp[g].end(), text.begin(), text.end());
               }
           }
        });
@@ -52,12 +53,16 @@ TokensPtr cpp_tokens_group(TokensPtr xptr,
 #else
     for (std::size_t g = 0; g < G; g++) {
         for (std::size_t h: groups[g]) {
-            temp[g].insert(temp[g].end(), texts[h - 1.begin(), texts[h - 1].end());
+            TextView text = obj.text(h - 1);
+            temp[g].insert(temp[g].end(), text.begin(), text.end());
         }
     }
 #endif
     
-    TokensObj *ptr_new = new TokensObj(temp, xptr->types, xptr->recompiled);
+    TokensObj *ptr_new = new TokensObj(std::move(temp), Types(), xptr->recompiled);
+    ptr_new->share_types(*xptr);
+    ptr_new->set_flat(xptr->flat);
+    ptr_new->set_compact(xptr->compact);
     TokensPtr xptr_new = TokensPtr(ptr_new, true);
     
     return xptr_new;
@@ -1,70 +1,77 @@
 #include "lib.h"
+#include "automaton.h"
 //#include "dev.h"
 
 using namespace quanteda;
 
-Text lookup(Text tokens, 
-            const std::vector<std::size_t> &spans,
+typedef std::pair<unsigned int, int> Count;
+typedef std::vector<Count> Counts;
+
+// positions of tokens matched to a key; intervals [first, last) never overlap
+typedef std::map<std::size_t, std::size_t> Intervals;
+
+// flag an interval if it does not overlap with the intervals already flagged
+bool flag_interval(Intervals &intervals, std::size_t first, std::size_t last) {
+    auto it = intervals.upper_bound(first);
+    if (it != intervals.end() && it->first < last)
+        return false;
+    if (it != intervals.begin() && first < std::prev(it)->second)
+        return false;
+    intervals.emplace_hint(it, first, last);
+    return true;
+}
+
+// find keys in a document; matched keys are recorded at the first position
+// of the sequences and matched positions are flagged
+std::size_t match_keys(const TextView &tokens,
+                       const int &overlap,
+                       const Automaton &automaton,
+                       const std::vector<unsigned int> &keys_pattern,
+                       std::vector< std::vector<unsigned int> > &keys,
+                       std::vector<bool> &flags_match_global){
+    
+    // Matched positions only for keys that are found
+    std::unordered_map<unsigned int, Intervals> intervals_match;
+    
+    std::size_t match_count = 0;
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        if (overlap == 2) { // global
+            bool flagged = std::all_of(flags_match_global.begin() + i, flags_match_global.begin() + i + span, [](bool v) { return v; });
+            if (flagged)
+                continue;
+        }
+        const std::vector<unsigned int> &pats = automaton.values(hit);
+        bool match = false;
+        for (unsigned int pat : pats) {
+            unsigned int id = keys_pattern[pat];
+            if (flag_interval(intervals_match[id], i, i + span)) { // for each key
+                keys[i].push_back(id); // keep multiple keys in the same position
+                match = true;
+                match_count++;
+            }
+        }
+        if (match)
+            std::fill(flags_match_global.begin() + i, flags_match_global.begin() + i + span, true); // for all keys
+    }
+    return match_count;
+}
+
+Text lookup(const TextView &tokens, 
             const unsigned int &id_max,
             const int &overlap,
             const int &nomatch,
-            const MultiMapNgrams &map_keys){
+            const Automaton &automaton,
+            const std::vector<unsigned int> &keys_pattern){
     
     if (tokens.size() == 0) return {}; // return empty vector for empty text
     
     // Match flag for each token
     std::vector<bool> flags_match_global(tokens.size(), false);
-    
-    // Match flag for each token for each key
-    std::vector< std::vector<bool> > flags_match(id_max);
-    if (overlap == 1 || overlap == 2) {
-        std::vector<bool> flags_init(tokens.size(), false);
-        for (unsigned int h = 0; h < id_max; h++) {
-            flags_match[h] = flags_init;
-            //Rcout << "h " << h << "\n";
-        }
-    }
-    
-    std::size_t match_count = 0;
     std::vector< std::vector<unsigned int> > keys(tokens.size());
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (std::size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto range = map_keys.equal_range(ngram);
-            bool match = false;
-            if (overlap == 1) { // local
-                for (auto it = range.first; it != range.second; ++it) {
-                    unsigned int id = it->second;
-                    std::vector< bool > &flags_match_local = flags_match[id - 1];
-                    bool flagged = std::any_of(flags_match_local.begin() + i, flags_match_local.begin() + i + span, [](bool v) { return v; });
-                    if (!flagged) {
-                        keys[i].push_back(id); // keep multiple keys in the same position
-                        std::fill(flags_match_local.begin() + i, flags_match_local.begin() + i + span, true); // for each key
-                        match = true;
-                        match_count++;
-                    }
-                }
-            } else if (overlap == 2) { // global
-                bool flagged = std::all_of(flags_match_global.begin() + i, flags_match_global.begin() + i + span, [](bool v) { return v; });
-                if (!flagged) {
-                    for (auto it = range.first; it != range.second; ++it) {
-                        unsigned int id = it->second;
-                        std::vector< bool > &flags_match_local = flags_match[id - 1];
-                        bool flagged = std::any_of(flags_match_local.begin() + i, flags_match_local.begin() + i + span, [](bool v) { return v; });
-                        if (!flagged) {
-                            keys[i].push_back(id); // keep multiple keys in the same position
-                            std::fill(flags_match_local.begin() + i, flags_match_local.begin() + i + span, true); // for each key
-                            match = true;
-                            match_count++;
-                        }
-                    }
-                }
-            }
-            if (match)
-                std::fill(flags_match_global.begin() + i, flags_match_global.begin() + i + span, true); // for all keys
-        }
-    }
+    std::size_t match_count = match_keys(tokens, overlap, automaton, keys_pattern, 
+                                         keys, flags_match_global);
     
     if (match_count == 0) {
         if (nomatch == 0) {
@@ -117,6 +124,46 @@ Text lookup(Text tokens,
     return keys_flat;
 }
 
+// count keys in a document; unmatched tokens are counted as id_max if nomatch is 1
+Counts count_keys(const TextView &tokens, 
+                  const unsigned int &id_max,
+                  const int &overlap,
+                  const int &nomatch,
+                  const Automaton &automaton,
+                  const std::vector<unsigned int> &keys_pattern){
+    
+    if (tokens.size() == 0) return {};
+    
+    std::vector<bool> flags_match_global(tokens.size(), false);
+    std::vector< std::vector<unsigned int> > keys(tokens.size());
+    std::size_t match_count = match_keys(tokens, overlap, automaton, keys_pattern, 
+                                         keys, flags_match_global);
+    Text ids;
+    ids.reserve(match_count);
+    int count_nomatch = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        if (flags_match_global[i]) {
+            ids.insert(ids.end(), keys[i].begin(), keys[i].end());
+        } else if (nomatch == 1) {
+            count_nomatch++;
+        }
+    }
+    
+    // aggregate the same key IDs
+    std::sort(ids.begin(), ids.end()); // rows must be sorted in dgCMatrix
+    Counts counts;
+    for (std::size_t i = 0; i < ids.size(); i++) {
+        if (i == 0 || ids[i] != ids[i - 1]) {
+            counts.push_back(Count(ids[i], 1));
+        } else {
+            counts.back().second++;
+        }
+    }
+    if (count_nomatch > 0)
+        counts.push_back(Count(id_max, count_nomatch));
+    return counts;
+}
+
 /* 
 * Function to find dictionary keywords
 * The number of threads is set by RcppParallel::setThreadOptions()
@@ -137,7 +184,7 @@ TokensPtr cpp_tokens_lookup(TokensPtr xptr,
                                  const int nomatch,
                                  const int thread = 1) {
     
-    Texts texts = xptr->texts;
+    TokensObj &obj = *xptr;
     Types types = Rcpp::as<Types>(types_);
     
     if (words_.size() != keys_.size())
@@ -146,57 +193,105 @@ TokensPtr cpp_tokens_lookup(TokensPtr xptr,
     std::vector<unsigned int> keys = Rcpp::as< std::vector<unsigned int> >(keys_);
     unsigned int id_max(0);
     if (nomatch == 2) {
-        types.insert(types.end(), xptr->types.begin(), xptr->types.end());
+        const Types &types_old = obj.get_types();
+        types.insert(types.end(), types_old.begin(), types_old.end());
         if (keys_.size() > 0)
             id_max = *max_element(keys.begin(), keys.end());
     } else {
         id_max = types.size();
     }
-    MultiMapNgrams map_keys;
-    map_keys.max_load_factor(GLOBAL_PATTERN_MAX_LOAD_FACTOR);
-    Ngrams words = Rcpp::as<Ngrams>(words_);
-    
-    size_t G = words.size();
-    std::vector<std::size_t> spans(G);
-    for (size_t g = 0; g < G; g++) {
-        Ngram value = words[g];
-        unsigned int key = keys[g];
-        map_keys.insert(std::pair<Ngram, unsigned int>(value, key));
-        spans[g] = value.size();
-    }
-    sort(spans.begin(), spans.end());
-    spans.erase(unique(spans.begin(), spans.end()), spans.end());
-    std::reverse(std::begin(spans), std::end(spans));
+    Automaton automaton_temp;
+    const Automaton &automaton = get_patterns(words_, obj, automaton_temp);
     
     //dev::stop_timer("Map construction", timer);
     
     //dev::start_timer("Dictionary lookup", timer);
-    std::size_t H = texts.size();
+    obj.transform([&](std::size_t h) {
+        return lookup(obj.text(h), id_max, overlap, nomatch, automaton, keys);
+    }, thread);
+    
+    xptr->set_types(std::move(types));
+    
+    if (nomatch != 2) { // exclusive mode
+        // NOTE: values might need to be reset
+        xptr->recompiled = true;
+    } else {
+        xptr->recompiled = false;
+    }
+    return xptr;
+}
+
+/* 
+* Function to count dictionary keywords without creating tokens
+* The number of threads is set by RcppParallel::setThreadOptions()
+* @used dfm_lookup()
+* @param words_ list of dictionary values
+* @param keys_ IDs of dictionary keys
+* @param types_ names of the keys followed by the name for no-match
+* @param overlap ignore overlapped words: 1=local, 2=global
+* @param nomatch determine how to treat unmached words: 0=remove, 1=count
+* @return keys x documents matrix
+*/
+
+// [[Rcpp::export]]
+S4 cpp_dfm_lookup(TokensPtr xptr,
+                  const List &words_,
+                  const IntegerVector &keys_,
+                  const CharacterVector &types_,
+                  const int overlap,
+                  const int nomatch,
+                  const int thread = 1) {
+    
+    TokensObj &obj = *xptr;
+    if (words_.size() != keys_.size())
+        throw std::range_error("Invalid words and keys");
+    
+    std::vector<unsigned int> keys = Rcpp::as< std::vector<unsigned int> >(keys_);
+    unsigned int id_max = types_.size();
+    Automaton automaton_temp;
+    const Automaton &automaton = get_patterns(words_, obj, automaton_temp);
+    
+    std::size_t H = obj.size();
+    std::vector<Counts> counts(H);
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
             for (int h = r.begin(); h < r.end(); ++h) {
-                texts[h] = lookup(texts[h], spans, id_max, overlap, nomatch, map_keys);
+                counts[h] = count_keys(obj.text(h), id_max, overlap, nomatch, automaton, keys);
             }    
         });
     });
 #else
     for (std::size_t h = 0; h < H; h++) {
-        texts[h] = lookup(texts[h], spans, id_max, overlap, nomatch, map_keys);
+        counts[h] = count_keys(obj.text(h), id_max, overlap, nomatch, automaton, keys);
     }
 #endif
     
-    xptr->texts = texts;
-    xptr->types = types;
-    
-    if (nomatch != 2) { // exclusive mode
-        // NOTE: values might need to be reset
-        xptr->recompiled = true;
-    } else {
-        xptr->recompiled = false;
+    std::size_t N = 0;
+    for (std::size_t h = 0; h < H; h++)
+        N += counts[h].size();
+    IntegerVector slot_p_(H + 1), slot_i_(N);
+    DoubleVector slot_x_(N);
+    std::size_t n = 0;
+    slot_p_[0] = 0;
+    for (std::size_t h = 0; h < H; h++) {
+        for (const Count &count : counts[h]) {
+            slot_i_[n] = count.first - 1;
+            slot_x_[n] = count.second;
+            n++;
+        }
+        Counts().swap(counts[h]);
+        slot_p_[h + 1] = n;
     }
-    return xptr;
+    
+    S4 dfm_("dgCMatrix");
+    dfm_.slot("p") = slot_p_;
+    dfm_.slot("i") = slot_i_;
+    dfm_.slot("x") = slot_x_;
+    dfm_.slot("Dim") = IntegerVector::create(id_max, H);
+    dfm_.slot("Dimnames") = List::create(types_, R_NilValue);
+    return(dfm_);
 }
 
 /***R
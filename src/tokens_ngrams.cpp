@@ -3,7 +3,7 @@
 //#include "dev.h"
 using namespace quanteda;
 
-Text skipgram(const Text &tokens,
+Text skipgram(const TextView &tokens,
               const std::vector<unsigned int> &ns, 
               const std::vector<unsigned int> &skips,
               MapNgrams &map_ngram,
@@ -52,8 +52,8 @@ TokensPtr cpp_tokens_ngrams(TokensPtr xptr,
                             const IntegerVector skips_,
                             const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    TokensObj &obj = *xptr;
+    const Types &types = obj.get_types();
     std::string delim = delim_;
     std::vector<unsigned int> ns = Rcpp::as< std::vector<unsigned int> >(ns_);
     std::vector<unsigned int> skips = Rcpp::as< std::vector<unsigned int> >(skips_);
@@ -64,23 +64,14 @@ TokensPtr cpp_tokens_ngrams(TokensPtr xptr,
     
     //dev::Timer timer;
     //dev::start_timer("Ngram generation", timer);
-    std::size_t H = texts.size();
 #if QUANTEDA_USE_TBB
     IdNgram id_ngram(1);
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                texts[h] = skipgram(texts[h], ns, skips, map_ngram, id_ngram);
-            }    
-        });
-    });
 #else
     IdNgram id_ngram = 1;
-    for (std::size_t h = 0; h < H; h++) {
-        texts[h] = skipgram(texts[h], ns, skips, map_ngram, id_ngram);
-    }
 #endif
+    obj.transform([&](std::size_t h) {
+        return skipgram(obj.text(h), ns, skips, map_ngram, id_ngram);
+    }, thread);
     //dev::stop_timer("Ngram generation", timer);
     
     // Extract only keys in order of the id
@@ -94,6 +85,7 @@ TokensPtr cpp_tokens_ngrams(TokensPtr xptr,
     std::size_t I = keys_ngram.size();
     Types types_new(I);
 #if QUANTEDA_USE_TBB
+    tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, I), [&](tbb::blocked_range<int> r) {
           for (int i = r.begin(); i < r.end(); ++i) {
@@ -107,8 +99,7 @@ TokensPtr cpp_tokens_ngrams(TokensPtr xptr,
     }
 #endif
     
-    xptr->texts = texts;
-    xptr->types = types_new;
+    xptr->set_types(std::move(types_new));
     xptr->recompiled = false;
     return xptr;
 
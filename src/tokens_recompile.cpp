@@ -11,17 +11,19 @@ using namespace quanteda;
 * @param types_ types in tokens
 * @param gap if TRUE, remove gaps between token IDs
 * @param dup if TRUE, merge duplicated token types into the same ID 
+* @param thread the number of threads to use
 */
 
 // [[Rcpp::export]]
 List cpp_tokens_recompile(const List &texts_, 
                                const CharacterVector types_,
                                const bool gap = true,
-                               const bool dup = true){
+                               const bool dup = true,
+                               const int thread = 1){
     
     Texts texts = Rcpp::as<Texts>(texts_);
     Types types = Rcpp::as<Types>(types_);
-    return recompile(texts, types, gap, dup);
+    return recompile(texts, types, gap, dup, true, thread);
     
 }
 
@@ -1,11 +1,11 @@
 #include "lib.h"
+#include "automaton.h"
 //#include "dev.h"
 
 using namespace quanteda;
 
-Text replace(Text tokens, 
-             const std::vector<std::size_t> &spans,
-             MapNgrams &map_pat,
+Text replace(const TextView &tokens, 
+             const Automaton &automaton,
              Ngrams &ids_repls){
     
     if (tokens.size() == 0) return {}; // return empty vector for empty text
@@ -15,23 +15,18 @@ Text replace(Text tokens,
     std::size_t match = 0;
     bool none = true;
     
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        //Rcout << "span:" << span << "\n";
-        for (std::size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto it = map_pat.find(ngram);
-            if (it != map_pat.end()) {
-                std::fill(flags_match.begin() + i, flags_match.begin() + i + span, true); // mark tokens matched
-                tokens_multi[i].insert(tokens_multi[i].end(), ids_repls[it->second].begin(), ids_repls[it->second].end());
-                match += ids_repls[it->second].size();
-                none = false;
-            }
-        }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        const Ngram &ids_repl = ids_repls[automaton.values(hit).front()];
+        std::fill(flags_match.begin() + i, flags_match.begin() + i + span, true); // mark tokens matched
+        tokens_multi[i].insert(tokens_multi[i].end(), ids_repl.begin(), ids_repl.end());
+        match += ids_repl.size();
+        none = false;
     }
     
     // return original tokens if no match
-    if (none) return tokens; 
+    if (none) return Text(tokens.begin(), tokens.end()); 
     
     // Add original tokens that did not match
     for (std::size_t i = 0; i < tokens.size(); i++) {
@@ -69,44 +64,25 @@ TokensPtr cpp_tokens_replace(TokensPtr xptr,
                              const List &replacements_,
                              const int thread = -1) {
     
-    Texts texts = xptr->texts;
+    TokensObj &obj = *xptr;
     Ngrams ids_repls = Rcpp::as<Ngrams>(replacements_);
     //dev::Timer timer;
     //dev::start_timer("Map construction", timer);
 
-    MapNgrams map_pat;
-    map_pat.max_load_factor(GLOBAL_PATTERN_MAX_LOAD_FACTOR);
+    Automaton automaton;
     Ngrams pats = Rcpp::as<Ngrams>(patterns_);
 
     size_t len = std::min(pats.size(), ids_repls.size());
-    std::vector<std::size_t> spans(len);
     for (size_t g = 0; g < len; g++) {
-        Ngram pat = pats[g];
-        map_pat.insert(std::pair<Ngram, unsigned int>(pat, g));
-        spans[g] = pat.size();
+        automaton.insert(pats[g], g);
     }
-    sort(spans.begin(), spans.end());
-    spans.erase(unique(spans.begin(), spans.end()), spans.end());
-    std::reverse(std::begin(spans), std::end(spans));
+    automaton.compile();
     //dev::stop_timer("Map construction", timer);
     
     //dev::start_timer("Pattern replace", timer);
-    std::size_t H = texts.size();
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                texts[h] = replace(texts[h], spans, map_pat, ids_repls);
-            }    
-        });
-    });
-#else
-    for (std::size_t h = 0; h < H; h++) {
-        texts[h] = replace(texts[h], spans, map_pat, ids_repls);
-    }
-#endif
-    xptr->texts = texts;
+    obj.transform([&](std::size_t h) {
+        return replace(obj.text(h), automaton, ids_repls);
+    }, thread);
     xptr->recompiled = false;
     return xptr;
 }
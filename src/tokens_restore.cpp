@@ -3,7 +3,7 @@
 #include "skipgram.h"
 using namespace quanteda;
 
-Text join_mark(Text tokens, 
+Text join_mark(const TextView &tokens, 
                const MapNgrams &map_marks,
                MapNgrams &map_comps,
                IdNgram &id_comp){
@@ -16,8 +16,9 @@ Text join_mark(Text tokens,
 
     int from = 0;
     int to = 0;
+    Ngram ngram(1), tokens_seq; // reuse the buffers to avoid allocation
     for (std::size_t i = 0; i < tokens.size(); i++) {
-        Ngram ngram(tokens.begin() + i, tokens.begin() + i + 1);
+        ngram[0] = tokens[i];
         auto it = map_marks.find(ngram);
         if (it != map_marks.end()) {
             match++;
@@ -29,7 +30,7 @@ Text join_mark(Text tokens,
             }
             if (from < to) {
                 std::fill(flags_match.begin() + from + 1, flags_match.begin() + to, true); // mark tokens matched
-                Ngram tokens_seq(tokens.begin() + from + 1, tokens.begin() + to); // extract tokens between marks
+                tokens_seq.assign(tokens.begin() + from + 1, tokens.begin() + to); // extract tokens between marks
                 tokens_multi[i].push_back(ngram_id(tokens_seq, map_comps, id_comp)); // assign ID to ngram
                 from = i;
                 to = i;
@@ -37,7 +38,7 @@ Text join_mark(Text tokens,
         }
     }
     
-    if (match == 0) return tokens; // return original tokens if no match
+    if (match == 0) return Text(tokens.begin(), tokens.end()); // return original tokens if no match
     
     // Add original tokens that did not match
     for (std::size_t i = 0; i < tokens.size(); i++) {
@@ -75,8 +76,8 @@ TokensPtr cpp_tokens_restore(TokensPtr xptr,
                         const String &delim_,
                         const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    TokensObj &obj = *xptr;
+    Types &types = obj.mutable_types();
     std::string delim = delim_;
 
     unsigned int id_last = types.size();
@@ -106,21 +107,9 @@ TokensPtr cpp_tokens_restore(TokensPtr xptr,
      
     // dev::Timer timer;
     // dev::start_timer("Token compound", timer);
-    std::size_t H = texts.size();
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-        arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                texts[h] = join_mark(texts[h], map_marks, map_comps, id_comp);
-            }    
-        });
-    });
-#else
-    for (std::size_t h = 0; h < H; h++) {
-        texts[h] = join_mark(texts[h], map_marks, map_comps, id_comp);
-    }
-#endif
+    obj.transform([&](std::size_t h) {
+        return join_mark(obj.text(h), map_marks, map_comps, id_comp);
+    }, thread);
 
     // Extract only keys in order of the ID
     VecNgrams ids_comp(id_comp - id_last - 1);
@@ -136,11 +125,10 @@ TokensPtr cpp_tokens_restore(TokensPtr xptr,
     for (std::size_t i = 0; i < ids_comp.size(); i++) {
         types_comp[i] = join_strings(ids_comp[i], types, delim);
     }
-    types.insert(types.end(), types_comp.begin(), types_comp.end());
+    types.insert(types.end(), std::make_move_iterator(types_comp.begin()), 
+                 std::make_move_iterator(types_comp.end()));
     
     // dev::stop_timer("Token compound", timer);
-    xptr->texts = texts;
-    xptr->types = types;
     xptr->recompiled = false;
     return xptr;
 }
@@ -0,0 +1,265 @@
+#include "lib.h"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+using namespace quanteda;
+
+/*
+ * Binary files of tokens_xptr objects
+ *
+ * All the numbers are in the byte order of the machine that wrote the file:
+ *
+ * header   magic number "QTDATOKS", 32-bit format version, 32-bit byte-order
+ *          mark, 64-bit numbers of documents, types, tokens and bytes of
+ *          types and attributes, 64-bit recompiled flag
+ * types    64-bit offsets of each type (ntype + 1), followed by the
+ *          characters of all the types in UTF-8, padded to 8 bytes
+ * docs     64-bit offsets of each document in tokens (ndoc + 1)
+ * tokens   32-bit token IDs of all the documents, padded to 8 bytes
+ * attrs    attributes of the object serialized by R
+ *
+ * Documents and offsets are aligned to 8 bytes so that they can be used
+ * directly in a memory-mapped file.
+ */
+
+const char TOKENS_MAGIC[8] = {'Q', 'T', 'D', 'A', 'T', 'O', 'K', 'S'};
+const uint32_t TOKENS_FORMAT = 1;
+const uint32_t TOKENS_BYTE_ORDER = 0x01020304;
+
+struct Header {
+    char magic[8];
+    uint32_t format;
+    uint32_t order;
+    uint64_t ndoc;
+    uint64_t ntype;
+    uint64_t ntoken;
+    uint64_t nchar;
+    uint64_t nattr;
+    uint64_t recompiled;
+};
+
+inline uint64_t padded(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+inline void write_padding(std::ofstream &out, uint64_t n) {
+    static const char zeros[8] = {0};
+    out.write(zeros, padded(n) - n);
+}
+
+// write the object to a stream in the format above
+void write_tokens(std::ofstream &out, const TokensObj &obj, const RawVector &attrs_) {
+
+    const Types &types = obj.get_types();
+    std::size_t H = obj.size();
+
+    Header header;
+    std::memcpy(header.magic, TOKENS_MAGIC, 8);
+    header.format = TOKENS_FORMAT;
+    header.order = TOKENS_BYTE_ORDER;
+    header.ndoc = H;
+    header.ntype = types.size();
+    header.ntoken = 0;
+    for (std::size_t h = 0; h < H; h++)
+        header.ntoken += obj.ntoken(h);
+    header.nchar = 0;
+    for (std::size_t g = 0; g < types.size(); g++)
+        header.nchar += types[g].size();
+    header.nattr = attrs_.size();
+    header.recompiled = obj.recompiled;
+    out.write((const char*)&header, sizeof(Header));
+
+    Offsets offsets(types.size() + 1, 0);
+    for (std::size_t g = 0; g < types.size(); g++)
+        offsets[g + 1] = offsets[g] + types[g].size();
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    for (std::size_t g = 0; g < types.size(); g++)
+        out.write(types[g].data(), types[g].size());
+    write_padding(out, header.nchar);
+
+    offsets.assign(H + 1, 0);
+    for (std::size_t h = 0; h < H; h++)
+        offsets[h + 1] = offsets[h] + obj.ntoken(h);
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    for (std::size_t h = 0; h < H; h++) {
+        TextView text = obj.text(h);
+        out.write((const char*)text.begin(), text.size() * sizeof(unsigned int));
+    }
+    write_padding(out, header.ntoken * sizeof(unsigned int));
+
+    out.write((const char*)RAW(attrs_), attrs_.size());
+}
+
+/*
+ * Function to write tokens_xptr to a file
+ * The object is written to a temporary file that replaces the file at the end,
+ * so objects loaded from the file by memory mapping keep the old content
+ * @used save_tokens_xptr()
+ * @param attrs_ attributes of the object serialized by R
+ */
+
+// [[Rcpp::export]]
+void cpp_save_xptr(TokensPtr xptr, const String &file_, const RawVector &attrs_) {
+
+    std::string file = file_.get_cstring();
+#ifdef _WIN32
+    std::string file_temp = file + ".tmp";
+#else
+    std::string file_temp = file + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    std::ofstream out(file_temp.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::range_error("Cannot open the file to write");
+    try {
+        write_tokens(out, *xptr, attrs_);
+    } catch (...) {
+        out.close();
+        std::remove(file_temp.c_str());
+        throw;
+    }
+    out.close();
+    if (!out) {
+        std::remove(file_temp.c_str());
+        throw std::range_error("Cannot write to the file");
+    }
+#ifdef _WIN32
+    std::remove(file.c_str()); // rename() does not replace files on Windows
+#endif
+    if (std::rename(file_temp.c_str(), file.c_str()) != 0) {
+        std::remove(file_temp.c_str());
+        throw std::range_error("Cannot write to the file");
+    }
+}
+
+// map a file to memory or read it if memory mapping is not available
+std::shared_ptr<const char> open_file(const std::string &file, uint64_t &size, bool mmap) {
+#ifndef _WIN32
+    if (mmap) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::range_error("Cannot open the file to read");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::range_error("Cannot open the file to read");
+        }
+        size = st.st_size;
+        if (size < sizeof(Header)) {
+            close(fd);
+            throw std::range_error("Invalid tokens file");
+        }
+        void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping is kept after closing
+        if (addr == MAP_FAILED)
+            throw std::range_error("Cannot map the file to memory");
+        uint64_t length = size;
+        return std::shared_ptr<const char>((const char*)addr, [length](const char *p) {
+            munmap((void*)p, length);
+        });
+    }
+#endif
+    std::ifstream in(file.c_str(), std::ios::binary | std::ios::ate);
+    if (!in)
+        throw std::range_error("Cannot open the file to read");
+    size = in.tellg();
+    if (size < sizeof(Header))
+        throw std::range_error("Invalid tokens file");
+    char *data = new char[size];
+    std::shared_ptr<const char> buffer(data, std::default_delete<char[]>());
+    in.seekg(0);
+    in.read(data, size);
+    if (!in)
+        throw std::range_error("Cannot read the file");
+    return buffer;
+}
+
+/*
+ * Function to read tokens_xptr from a file
+ * @used load_tokens_xptr()
+ * @param mmap if TRUE, token IDs are not read until they are used
+ * @return a list of the object and its attributes serialized by R
+ */
+
+// [[Rcpp::export]]
+List cpp_load_xptr(const String &file_, const bool mmap = true) {
+
+    uint64_t size = 0;
+    std::shared_ptr<const char> file = open_file(file_.get_cstring(), size, mmap);
+
+    Header header;
+    std::memcpy(&header, file.get(), sizeof(Header));
+    if (std::memcmp(header.magic, TOKENS_MAGIC, 8) != 0 || header.format != TOKENS_FORMAT)
+        throw std::range_error("Invalid tokens file");
+    if (header.order != TOKENS_BYTE_ORDER)
+        throw std::range_error("Tokens file was written on a machine of different byte order");
+
+    // numbers larger than the file are invalid, so the positions do not overflow
+    if (header.ntype >= size / sizeof(uint64_t) || header.ndoc >= size / sizeof(uint64_t) ||
+        header.ntoken > size / sizeof(unsigned int) || header.nchar > size || 
+        header.nattr > size || header.recompiled > 1)
+        throw std::range_error("Invalid tokens file");
+
+    uint64_t pos_type = sizeof(Header);
+    uint64_t pos_char = pos_type + (header.ntype + 1) * sizeof(uint64_t);
+    uint64_t pos_doc = pos_char + padded(header.nchar);
+    uint64_t pos_token = pos_doc + (header.ndoc + 1) * sizeof(uint64_t);
+    uint64_t pos_attr = pos_token + padded(header.ntoken * sizeof(unsigned int));
+    if (size != pos_attr + header.nattr)
+        throw std::range_error("Invalid tokens file");
+
+    // types are always copied
+    const uint64_t *offsets = (const uint64_t*)(file.get() + pos_type);
+    const char *chars = file.get() + pos_char;
+    Types types(header.ntype);
+    for (std::size_t g = 0; g < header.ntype; g++) {
+        if (offsets[g] > offsets[g + 1] || offsets[g + 1] > header.nchar)
+            throw std::range_error("Invalid tokens file");
+        types[g] = Type(chars + offsets[g], chars + offsets[g + 1]);
+    }
+
+    offsets = (const uint64_t*)(file.get() + pos_doc);
+    Ranges ranges(header.ndoc);
+    for (std::size_t h = 0; h < header.ndoc; h++) {
+        if (offsets[h] > offsets[h + 1] || offsets[h + 1] > header.ntoken)
+            throw std::range_error("Invalid tokens file");
+        ranges[h] = Range(offsets[h], offsets[h + 1]);
+    }
+
+    // token IDs are only checked when the file is read; memory-mapped files 
+    // are trusted not to read all the pages
+    const unsigned int *ids = (const unsigned int*)(file.get() + pos_token);
+    if (!mmap) {
+        for (std::size_t i = 0; i < header.ntoken; i++) {
+            if (ids[i] > header.ntype)
+                throw std::range_error("Invalid tokens file");
+        }
+    }
+    bool recompiled = header.recompiled == 1 && !is_duplicated(types);
+
+    // the number of documents is given by the ranges
+    TokensPtr ptr(new TokensObj(Texts(), std::move(types), recompiled), true);
+    if (header.ntoken > 0) {
+        // token IDs stay in the file until they are modified
+        std::shared_ptr<const unsigned int> buffer(file, ids);
+        ptr->set_buffer(buffer, std::move(ranges));
+    } else {
+        ptr->set_ids(Ids(), std::move(ranges));
+    }
+
+    RawVector attrs_(header.nattr);
+    std::memcpy(RAW(attrs_), file.get() + pos_attr, header.nattr);
+    return List::create(ptr, attrs_);
+}
+
+/***R
+xtoks <- as.tokens_xptr(tokens(c("a b c", "b c d")))
+file <- tempfile()
+cpp_save_xptr(xtoks, file, serialize(attributes(xtoks), NULL))
+cpp_load_xptr(file)
+*/
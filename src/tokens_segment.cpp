@@ -1,4 +1,5 @@
 #include "lib.h"
+#include "automaton.h"
 //#include "dev.h"
 using namespace quanteda;
 
@@ -8,25 +9,19 @@ typedef std::vector<Target> Targets;
 typedef std::tuple<int, int, int, int> Segment;
 typedef std::vector<Segment> Segments;
 
-Segments segment(Text tokens,
+Segments segment(const TextView &tokens,
                  UintParam &N,
-                const std::vector<std::size_t> &spans,
-                const SetNgrams &set_patterns,
+                const Automaton &automaton,
                 const bool &remove,
                 const int &position){
     
     if(tokens.size() == 0) return {}; // return empty vector for empty text
     
     Targets targets;
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (size_t i = 0; i < tokens.size() - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            bool is_in = set_patterns.find(ngram) != set_patterns.end();
-            if (is_in) {
-                targets.push_back(std::make_pair(i, i + span - 1));
-            }
-        }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    targets.reserve(hits.size());
+    for (const Hit &hit : hits) {
+        targets.push_back(std::make_pair(hit.pos, hit.pos + hit.span - 1));
     }
     
     Segments segments;
@@ -105,29 +100,28 @@ TokensPtr cpp_tokens_segment(TokensPtr xptr,
                              const int &position,
                              const int thread = -1) {
     
-    Texts texts = xptr->texts;
-    Types types = xptr->types;
+    const TokensObj &obj = *xptr;
     UintParam N = 0;
-    SetNgrams set_patterns;
-    std::vector<std::size_t> spans = register_ngrams(patterns_, set_patterns);
+    Automaton automaton_temp;
+    const Automaton &automaton = get_patterns(patterns_, obj, automaton_temp);
     
     // dev::Timer timer;
 
     // dev::start_timer("Dictionary detect", timer);
-    std::size_t H = texts.size();
+    std::size_t H = obj.size();
     std::vector<Segments> temp(H);
 #if QUANTEDA_USE_TBB
     tbb::task_arena arena(thread);
     arena.execute([&]{
         tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
             for (int h = r.begin(); h < r.end(); ++h) {
-                temp[h] = segment(texts[h], N, spans, set_patterns, remove, position);
+                temp[h] = segment(obj.text(h), N, automaton, remove, position);
             }    
         });
     });
 #else
-    for (std::size_t h = 0; h < texts.size(); h++) {
-        temp[h] = segment(texts[h], N, spans, set_patterns, remove, position);
+    for (std::size_t h = 0; h < H; h++) {
+        temp[h] = segment(obj.text(h), N, automaton, remove, position);
     }
 #endif
     
@@ -139,7 +133,7 @@ TokensPtr cpp_tokens_segment(TokensPtr xptr,
     for (std::size_t h = 0; h < temp.size(); h++) {
         Segments targets = temp[h];
         if (targets.size() == 0) continue;
-        Text tokens = texts[h];
+        TextView tokens = obj.text(h);
         for (size_t i = 0; i < targets.size(); i++) {
             Segment target = targets[i];
             
@@ -154,7 +148,7 @@ TokensPtr cpp_tokens_segment(TokensPtr xptr,
             // extract matched patterns
             if (remove && 0 <= std::get<2>(target) && 0 <= std::get<3>(target)) {
                 Text match(tokens.begin() + std::get<2>(target), tokens.begin() + std::get<3>(target) + 1);
-                matches[j] = join_strings(match, types, " ");
+                matches[j] = join_strings(match, obj.get_types(), " ");
             } else {
                 matches[j] = "";
             }
@@ -164,7 +158,10 @@ TokensPtr cpp_tokens_segment(TokensPtr xptr,
     }
     
   
-    TokensObj *ptr_new = new TokensObj(segments, xptr->types, xptr->recompiled);
+    TokensObj *ptr_new = new TokensObj(std::move(segments), Types(), xptr->recompiled);
+    ptr_new->share_types(*xptr);
+    ptr_new->set_flat(xptr->flat);
+    ptr_new->set_compact(xptr->compact);
     TokensPtr xptr_new = TokensPtr(ptr_new, true);
     
     CharacterVector matches_ = encode(matches);
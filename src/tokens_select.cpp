@@ -1,13 +1,13 @@
 #include "lib.h"
+#include "automaton.h"
 //#include "dev.h"
 using namespace quanteda;
 
 typedef std::pair<int, int> Position;
 typedef std::vector<Position> Positions;
 
-Text keep_token(Text tokens, 
-          const std::vector<std::size_t> &spans,
-          const SetNgrams &set_words,
+Text keep_token(const TextView &tokens, 
+          const Automaton &automaton,
           const bool &padding,
           const std::pair<int, int> &window,
           const std::pair<int, int> &pos){
@@ -38,21 +38,17 @@ Text keep_token(Text tokens,
     } else {
         std::fill(tokens_copy.begin(), tokens_copy.end(), filler);
     }
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (std::size_t i = start; i < end - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto it = set_words.find(ngram);
-            if (it != set_words.end()) {
-                match = true;
-                if (window.first == 0 && window.second == 0) {
-                    std::copy(ngram.begin(), ngram.end(), tokens_copy.begin() + i);
-                } else {
-                    int from = std::max((int)i - window.first, 0);
-                    int to = std::min((int)i + (int)span + window.second, (int)tokens.size());
-                    std::copy(tokens.begin() + from, tokens.begin() + to, tokens_copy.begin() + from);
-                }
-            }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        if (i < start || end < i + span) continue;
+        match = true;
+        if (window.first == 0 && window.second == 0) {
+            std::copy(tokens.begin() + i, tokens.begin() + i + span, tokens_copy.begin() + i);
+        } else {
+            int from = std::max((int)i - window.first, 0);
+            int to = std::min((int)i + (int)span + window.second, (int)tokens.size());
+            std::copy(tokens.begin() + from, tokens.begin() + to, tokens_copy.begin() + from);
         }
     }
     if (match) {
@@ -67,9 +63,8 @@ Text keep_token(Text tokens,
     return tokens_copy;
 }
 
-Text remove_token(Text tokens, 
-            const std::vector<std::size_t> &spans,
-            const SetNgrams &set_words,
+Text remove_token(const TextView &tokens, 
+            const Automaton &automaton,
             const bool &padding,
             const std::pair<int, int> &window,
             const std::pair<int, int> &pos){
@@ -77,7 +72,7 @@ Text remove_token(Text tokens,
     if (tokens.size() == 0) return {}; // return empty vector for empty text
     
     unsigned int filler = UINT_MAX; // use upper limit as a filler
-    Text tokens_copy = tokens;
+    Text tokens_copy(tokens.begin(), tokens.end());
     bool match = false;
     std::size_t start, end;
     if (pos.first == 0) {
@@ -94,28 +89,24 @@ Text remove_token(Text tokens,
     } else {
         end = std::max(0, (int)tokens.size() + pos.second + 1);
     }
-    for (std::size_t span : spans) { // substitution starts from the longest sequences
-        if (tokens.size() < span) continue;
-        for (std::size_t i = start; i < end - (span - 1); i++) {
-            Ngram ngram(tokens.begin() + i, tokens.begin() + i + span);
-            auto it = set_words.find(ngram);
-            if (it != set_words.end()) {
-                match = true;
-                if (window.first == 0 && window.second == 0) {
-                    if (padding) {
-                        std::fill(tokens_copy.begin() + i, tokens_copy.begin() + i + span, 0);
-                    } else {
-                        std::fill(tokens_copy.begin() + i, tokens_copy.begin() + i + span, filler);
-                    }
-                } else {
-                    int from = std::max((int)i - window.first, 0);
-                    int to = std::min((int)i + (int)span + window.second, (int)tokens.size());
-                    if (padding) {
-                        std::fill(tokens_copy.begin() + from, tokens_copy.begin() + to, 0);
-                    } else {
-                        std::fill(tokens_copy.begin() + from, tokens_copy.begin() + to, filler);
-                    }
-                }
+    Hits hits = automaton.match(tokens); // longest sequences first
+    for (const Hit &hit : hits) {
+        std::size_t i = hit.pos, span = hit.span;
+        if (i < start || end < i + span) continue;
+        match = true;
+        if (window.first == 0 && window.second == 0) {
+            if (padding) {
+                std::fill(tokens_copy.begin() + i, tokens_copy.begin() + i + span, 0);
+            } else {
+                std::fill(tokens_copy.begin() + i, tokens_copy.begin() + i + span, filler);
+            }
+        } else {
+            int from = std::max((int)i - window.first, 0);
+            int to = std::min((int)i + (int)span + window.second, (int)tokens.size());
+            if (padding) {
+                std::fill(tokens_copy.begin() + from, tokens_copy.begin() + to, 0);
+            } else {
+                std::fill(tokens_copy.begin() + from, tokens_copy.begin() + to, filler);
             }
         }
     }
@@ -148,52 +139,35 @@ TokensPtr cpp_tokens_select(TokensPtr xptr,
                                  const IntegerVector pos_to_,
                                  const int thread = -1) {
 
-    Texts texts = xptr->texts;
+    TokensObj &obj = *xptr;
     std::pair<int, int> window(window_left, window_right);
     
-    SetNgrams set_words;
-    std::vector<std::size_t> spans = register_ngrams(words_, set_words);
+    Automaton automaton_temp;
+    const Automaton &automaton = get_patterns(words_, obj, automaton_temp);
     
-    if (pos_from_.size() != (int)texts.size())
+    std::size_t H = obj.size();
+    if (pos_from_.size() != (int)H)
         throw std::range_error("Invalid pos_from");
-    if (pos_to_.size() != (int)texts.size())
+    if (pos_to_.size() != (int)H)
         throw std::range_error("Invalid pos_to");
-    Positions pos(texts.size());
-    for (size_t g = 0; g < texts.size(); g++) {
+    Positions pos(H);
+    for (size_t g = 0; g < H; g++) {
         pos[g] = std::make_pair(pos_from_[g], pos_to_[g]);
     }
     
     // dev::Timer timer;
     // dev::start_timer("Token select", timer);
-    std::size_t H = texts.size();
-#if QUANTEDA_USE_TBB
-    tbb::task_arena arena(thread);
-    arena.execute([&]{
-        tbb::parallel_for(tbb::blocked_range<int>(0, H), [&](tbb::blocked_range<int> r) {
-            for (int h = r.begin(); h < r.end(); ++h) {
-                if (mode == 1) {
-                    texts[h] = keep_token(texts[h], spans, set_words, padding, window, pos[h]);
-                } else if(mode == 2) {
-                    texts[h] = remove_token(texts[h], spans, set_words, padding, window, pos[h]);
-                } else {
-                    texts[h] = texts[h];
-                }
-            }    
-        });
-    });
-#else
-    for (std::size_t h = 0; h < texts.size(); h++) {
+    obj.transform([&](std::size_t h) -> Text {
+        TextView text = obj.text(h);
         if (mode == 1) {
-            texts[h] = keep_token(texts[h], spans, set_words, padding, window, pos[h]);
+            return keep_token(text, automaton, padding, window, pos[h]);
         } else if(mode == 2) {
-            texts[h] = remove_token(texts[h], spans, set_words, padding, window, pos[h]);
+            return remove_token(text, automaton, padding, window, pos[h]);
         } else {
-            texts[h] = texts[h];
+            return Text(text.begin(), text.end());
         }
-    }
-#endif
+    }, thread);
     // dev::stop_timer("Token select", timer);
-    xptr->texts = texts;
     xptr->recompiled = false;
     return xptr;
 }
@@ -1,24 +1,156 @@
 #include "lib.h"
+#include "automaton.h"
 #include "dev.h"
 //#include "recompile.h"
 using namespace quanteda;
 
+/*
+ * Function to convert a list of integer vectors to tokens_xptr
+ * Token IDs and types are copied from the R objects only once in parallel and
+ * moved to TokensObj; in compact storage, token IDs are encoded directly from
+ * the R objects without being copied
+ */
+
 // [[Rcpp::export]]
 TokensPtr cpp_as_xptr(const List text_, 
-                      const CharacterVector types_) {
+                      const CharacterVector types_,
+                      const bool flat = false,
+                      const bool compact = false,
+                      const int thread = 1) {
     
-    Texts texts = Rcpp::as<Texts>(text_);
-    Types types = Rcpp::as<Types>(types_);
-    TokensObj *ptr = new TokensObj(texts, types);
+    // pointers are obtained in the main thread as R's API is not thread-safe
+    std::size_t H = text_.size();
+    std::vector<const int*> ptrs(H);
+    Ranges ranges(H);
+    uint64_t N = 0;
+    std::vector<IntegerVector> coerced; // numeric vectors converted to integer
+    for (std::size_t h = 0; h < H; h++) {
+        SEXP text = text_[h];
+        if (TYPEOF(text) != INTSXP) {
+            if (TYPEOF(text) != REALSXP && TYPEOF(text) != LGLSXP)
+                throw std::range_error("Invalid tokens object");
+            coerced.push_back(IntegerVector(text));
+            text = coerced.back();
+        }
+        ptrs[h] = INTEGER_RO(text);
+        ranges[h] = Range(N, N + XLENGTH(text));
+        N += XLENGTH(text);
+    }
+    std::size_t G = types_.size();
+    std::vector<const char*> chars(G);
+    std::vector<std::size_t> sizes(G);
+    for (std::size_t g = 0; g < G; g++) {
+        SEXP type = STRING_ELT(types_, g);
+        chars[g] = CHAR(type);
+        sizes[g] = LENGTH(type);
+    }
+    
+    Types types(G);
+    Texts texts;
+    Ids ids;
+    Bytes bytes;
+    std::vector<unsigned int> lengths;
+    if (compact) {
+        lengths.resize(H);
+    } else if (flat) {
+        ids.resize(N);
+    } else {
+        texts.resize(H);
+    }
+    
+    // token IDs are copied or measured for encoding 
+    auto copy = [&](std::size_t h) {
+        const unsigned int *first = (const unsigned int*)ptrs[h];
+        const unsigned int *last = first + (ranges[h].second - ranges[h].first);
+        if (compact) {
+            lengths[h] = last - first;
+            ranges[h] = Range(0, size_ids(first, last)); // positions are set later
+        } else if (flat) {
+            std::copy(first, last, ids.begin() + ranges[h].first);
+        } else {
+            texts[h].assign(first, last);
+        }
+    };
+    // token IDs are encoded directly into the positions in the storage
+    auto encode = [&](std::size_t h) {
+        const unsigned int *first = (const unsigned int*)ptrs[h];
+        encode_ids(first, first + lengths[h], bytes.data() + ranges[h].first);
+    };
+#if QUANTEDA_USE_TBB
+    tbb::task_arena arena(thread);
+    arena.execute([&]{
+        tbb::parallel_for(tbb::blocked_range<int>(0, G), [&](tbb::blocked_range<int> r) {
+            for (int g = r.begin(); g < r.end(); ++g) {
+                types[g].assign(chars[g], sizes[g]);
+            }
+        });
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, H), [&](tbb::blocked_range<std::size_t> r) {
+            for (std::size_t h = r.begin(); h < r.end(); ++h)
+                copy(h);
+        });
+    });
+#else
+    for (std::size_t g = 0; g < G; g++) {
+        types[g].assign(chars[g], sizes[g]);
+    }
+    for (std::size_t h = 0; h < H; h++)
+        copy(h);
+#endif
+    if (compact) {
+        uint64_t n = 0;
+        for (std::size_t h = 0; h < H; h++) {
+            ranges[h] = Range(n, n + ranges[h].second);
+            n = ranges[h].second;
+        }
+        bytes.resize(n);
+#if QUANTEDA_USE_TBB
+        arena.execute([&]{
+            tbb::parallel_for(tbb::blocked_range<std::size_t>(0, H), [&](tbb::blocked_range<std::size_t> r) {
+                for (std::size_t h = r.begin(); h < r.end(); ++h)
+                    encode(h);
+            });
+        });
+#else
+        for (std::size_t h = 0; h < H; h++)
+            encode(h);
+#endif
+    }
+    
+    TokensObj *ptr = new TokensObj(Texts(), std::move(types));
+    if (compact) {
+        ptr->set_bytes(std::move(bytes), std::move(ranges), std::move(lengths));
+    } else if (flat) {
+        ptr->set_ids(std::move(ids), std::move(ranges));
+    } else {
+        ptr->add_texts(std::move(texts));
+    }
     return TokensPtr(ptr, true);
 }
 
 // [[Rcpp::export]]
 TokensPtr cpp_copy_xptr(TokensPtr xptr) {
-    TokensObj *ptr_copy = new TokensObj(xptr->texts, xptr->types, xptr->recompiled);
+    // documents, types and counts are shared until modified
+    TokensObj *ptr_copy = new TokensObj(*xptr);
     return TokensPtr(ptr_copy, true);
 }
 
+// [[Rcpp::export]]
+TokensPtr cpp_set_flat(TokensPtr xptr, const bool flat) {
+    xptr->set_flat(flat);
+    return xptr;
+}
+
+// [[Rcpp::export]]
+TokensPtr cpp_set_compact(TokensPtr xptr, const bool compact) {
+    xptr->set_compact(compact);
+    return xptr;
+}
+
+// [[Rcpp::init]]
+void cpp_register_altrep(DllInfo *dll) {
+    register_altrep(dll);
+}
+
 // [[Rcpp::export]]
 List cpp_get_attributes(TokensPtr xptr) {
     List list_ = List::create(_["recompiled"] = xptr->recompiled);
@@ -26,57 +158,77 @@ List cpp_get_attributes(TokensPtr xptr) {
 }
 
 // [[Rcpp::export]]
-List cpp_as_list(TokensPtr xptr) {
-    xptr->recompile();
-    Tokens texts_ = as_list(xptr->texts);
-    texts_.attr("types") = encode(xptr->types);;
+List cpp_as_list(TokensPtr xptr, const int thread = 1) {
+    xptr->recompile(thread);
+    List texts_ = lazy_texts(*xptr);
+    texts_.attr("types") = xptr->encoded_types();
     texts_.attr("class") = "tokens";
     return texts_;
 }
 
 // [[Rcpp::export]]
 TokensPtr cpp_subset(TokensPtr xptr, IntegerVector index_) {
-    std::vector<int> index = Rcpp::as< std::vector<int> >(index_);
-    Texts texts(index.size());
+    const TokensObj &obj = *xptr;
+    std::vector<int> index_temp = Rcpp::as< std::vector<int> >(index_);
+    std::vector<std::size_t> index(index_temp.size());
     for (std::size_t i = 0; i < index.size(); i++) {
-        if (index[i] < 1 || index[i] - 1 >= (int)xptr->texts.size()) {
+        if (index_temp[i] < 1 || index_temp[i] - 1 >= (int)obj.size()) {
             throw std::range_error("Invalid document index");
         }
-        texts[i] = xptr->texts[index[i] - 1];
+        index[i] = index_temp[i] - 1;
     }
-    TokensObj *ptr_new = new TokensObj(texts, xptr->types, xptr->recompiled);
+    // documents and types are shared until modified
+    TokensObj *ptr_new = new TokensObj(obj.subset(index));
     return TokensPtr(ptr_new, true);
 }
 
+// [[Rcpp::export]]
+SEXP cpp_compile_patterns(TokensPtr xptr, const List &words_) {
+    Automaton *ptr = new Automaton();
+    register_ngrams(words_, *ptr);
+    ptr->version = xptr->types_version();
+    return PatternsPtr(ptr, true);
+}
+
+// check if patterns are compiled for the current types of the object
+// [[Rcpp::export]]
+bool cpp_check_patterns(TokensPtr xptr, SEXP compiled_) {
+    if (TYPEOF(compiled_) != EXTPTRSXP || R_ExternalPtrAddr(compiled_) == nullptr)
+        return false; // not restored after saved to a file
+    PatternsPtr ptr(compiled_);
+    return ptr->version == xptr->types_version();
+}
+
 // [[Rcpp::export]]
 int cpp_ndoc(TokensPtr xptr) {
-    return xptr->texts.size();
+    return xptr->size();
 }
 
 
 // [[Rcpp::export]]
-IntegerVector cpp_ntoken(TokensPtr xptr) {
+IntegerVector cpp_ntoken(TokensPtr xptr, const int thread = 1) {
     //Rcout << "cpp_ntoken()\n";
-    xptr->recompile();
-    std::size_t H = xptr->texts.size();
+    xptr->recompile(thread);
+    std::size_t H = xptr->size();
     IntegerVector ls_(H);
     for (std::size_t h = 0; h < H; h++) {
-        ls_[h] = xptr->texts[h].size();
+        ls_[h] = xptr->ntoken(h);
     }
     return ls_;
 }
 
 // [[Rcpp::export]]
-IntegerVector cpp_ntype(TokensPtr xptr) {
-    xptr->recompile();
-    std::size_t H = xptr->texts.size();
+IntegerVector cpp_ntype(TokensPtr xptr, const int thread = 1) {
+    xptr->recompile(thread);
+    std::size_t H = xptr->size();
     IntegerVector ns_(H);
     for (std::size_t h = 0; h < H; h++) {
-        Text text = xptr->texts[h];
+        TextView text_h = xptr->text(h);
+        Text text(text_h.begin(), text_h.end());
         std::sort(text.begin(), text.end());
         text.erase(unique(text.begin(), text.end()), text.end());
         int n = text.size();
-        if (text[0] == 0)
+        if (n > 0 && text[0] == 0)
             n--;    
         ns_[h] = n;
     }
@@ -85,38 +237,40 @@ IntegerVector cpp_ntype(TokensPtr xptr) {
 
 
 // [[Rcpp::export]]
-CharacterVector cpp_get_types(TokensPtr xptr, bool recompile = false) {
+CharacterVector cpp_get_types(TokensPtr xptr, bool recompile = false, 
+                              const int thread = 1) {
     //Rcout << "cpp_types()\n";
     if (recompile)
-        xptr->recompile();
-    return encode(xptr->types);
+        xptr->recompile(thread);
+    return xptr->encoded_types();
 }
 
 // [[Rcpp::export]]
 TokensPtr cpp_set_types(TokensPtr xptr, const CharacterVector types_) {
     Types types = Rcpp::as<Types>(types_);
-    xptr->types = types;
+    xptr->set_types(std::move(types));
     xptr->recompiled = false;
     return xptr;
 }
 
 // [[Rcpp::export]]
-void cpp_recompile(TokensPtr xptr) {
-    xptr->recompile();
+void cpp_recompile(TokensPtr xptr, const int thread = 1) {
+    xptr->recompile(thread);
 }
 
 // [[Rcpp::export]]
-S4 cpp_dfm(TokensPtr xptr, bool asis = false) {
+S4 cpp_dfm(TokensPtr xptr, bool asis = false, const int thread = 1) {
     
     xptr->recompiled = asis;
-    xptr->recompile(); // remove unused types
-    std::size_t H = xptr->texts.size();
-    std::size_t G = xptr->types.size();
+    xptr->recompile(thread); // remove unused types
+    std::size_t H = xptr->size();
+    const Types &types_old = xptr->get_types();
+    std::size_t G = types_old.size();
     std::vector<unsigned int> ids(G, 0);
     
     int N = 0;
     for (std::size_t h = 0; h < H; h++)
-        N += xptr->texts[h].size();
+        N += xptr->ntoken(h);
     std::vector<double> slot_x;
     std::vector<int> slot_i, slot_p;
     slot_i.reserve(N);
@@ -129,21 +283,22 @@ S4 cpp_dfm(TokensPtr xptr, bool asis = false) {
     unsigned int id = 1;
     for (std::size_t h = 0; h < H; h++) {
         // assign new token IDs in the order of their occurrence
-        std::size_t I = xptr->texts[h].size();
+        TextView tokens = xptr->text(h);
+        std::size_t I = tokens.size();
         Text text(I);
         for (std::size_t i = 0; i < I; i++) {
-            if (xptr->texts[h][i] == 0) {
+            if (tokens[i] == 0) {
                 text[i] = 0;
                 count_pad++;
             } else {
                 if (asis) {
-                    text[i] = xptr->texts[h][i]; // for dictionary
+                    text[i] = tokens[i]; // for dictionary
                 } else {
-                    if (ids[xptr->texts[h][i] - 1] == 0) {
-                        ids[xptr->texts[h][i] - 1] = id;
+                    if (ids[tokens[i] - 1] == 0) {
+                        ids[tokens[i] - 1] = id;
                         id++;
                     }
-                    text[i] = ids[xptr->texts[h][i] - 1];
+                    text[i] = ids[tokens[i] - 1];
                 }
             }
         }
@@ -173,15 +328,15 @@ S4 cpp_dfm(TokensPtr xptr, bool asis = false) {
     
     // Rcout << "G: " << G << "\n";
     // Rcout << "ids: " << ids.size() << "\n";
-    // Rcout << "xptr->types: " << xptr->types.size() << "\n";
+    // Rcout << "types_old: " << types_old.size() << "\n";
     
     Types types(G);
     if (asis) {
-        types = xptr->types;
+        types = types_old;
     } else {
         for (std::size_t g = 0; g < G; g++) {
             if (ids[g] != 0) // zero if the types are not used
-                types[ids[g] - 1] = xptr->types[g];
+                types[ids[g] - 1] = types_old[g];
         }
     }
     CharacterVector types_ = encode(types);
@@ -0,0 +1,104 @@
+// Bucket lengths and lookup throughput of hash functions for n-grams
+// Run Rcpp::sourceCpp("tests/benchmarks/benchmark_hash_ngram.cpp")
+#include "lib.h"
+#include <chrono>
+// [[Rcpp::depends(quanteda, RcppParallel, RcppArmadillo)]]
+using namespace quanteda;
+
+// the hash function used until quanteda 4.0
+struct hash_ngram_old {
+    std::size_t operator() (const Ngram &vec) const {
+        unsigned int seed = 0;
+        for (std::size_t i = 0; i < vec.size(); i++) {
+            seed += vec[i] * (256 ^ i);
+        }
+        return std::hash<unsigned int>()(seed);
+    }
+};
+
+// the hash function used in fcm() until quanteda 4.0
+struct hash_pair_old {
+    std::size_t operator()(const std::pair<unsigned int, unsigned int> &p) const {
+        unsigned int seed = 0;
+        seed = p.first;
+        seed += p.second << 16;
+        return std::hash<unsigned int>()(seed);
+    }
+};
+
+typedef std::pair<unsigned int, unsigned int> Pair;
+
+template <typename Key, typename Hash>
+List bench(const std::vector<Key> &ngrams) {
+    std::unordered_set<Key, Hash> set;
+    set.max_load_factor(GLOBAL_NGRAMS_MAX_LOAD_FACTOR);
+    for (auto &ngram : ngrams)
+        set.insert(ngram);
+
+    // number of keys with different hash values
+    std::unordered_set<std::size_t> hashes;
+    Hash hash;
+    for (auto &key : set)
+        hashes.insert(hash(key));
+
+    // number of buckets by their lengths
+    std::vector<int> lengths;
+    for (std::size_t b = 0; b < set.bucket_count(); b++) {
+        std::size_t l = set.bucket_size(b);
+        if (lengths.size() <= l)
+            lengths.resize(l + 1, 0);
+        lengths[l]++;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::size_t n = 0;
+    for (auto &ngram : ngrams)
+        n += set.count(ngram);
+    auto end = std::chrono::high_resolution_clock::now();
+    double sec = std::chrono::duration<double>(end - start).count();
+
+    IntegerVector lengths_ = Rcpp::wrap(lengths);
+    lengths_.names() = seq(0, lengths.size() - 1);
+    return List::create(_["unique"] = set.size(),
+                        _["unique_hash"] = hashes.size(),
+                        _["bucket_length"] = lengths_,
+                        _["max_bucket_length"] = lengths.size() - 1,
+                        _["lookup_per_sec"] = n / sec);
+}
+
+// [[Rcpp::export]]
+List bench_hash_ngram(const List ngrams_) {
+    Ngrams ngrams = Rcpp::as<Ngrams>(ngrams_);
+    return List::create(_["old"] = bench<Ngram, hash_ngram_old>(ngrams),
+                        _["new"] = bench<Ngram, hash_ngram>(ngrams));
+}
+
+// [[Rcpp::export]]
+List bench_hash_pair(const IntegerVector first_, const IntegerVector second_) {
+    std::vector<Pair> pairs(first_.size());
+    for (int i = 0; i < first_.size(); i++)
+        pairs[i] = Pair(first_[i], second_[i]);
+    return List::create(_["old"] = bench<Pair, hash_pair_old>(pairs),
+                        _["new"] = bench<Pair, hash_pair>(pairs));
+}
+
+/***R
+# Zipfian corpus of 10 million tokens with 100,000 types
+set.seed(1234)
+nt <- 100000
+toks <- sample(nt, 1e7, replace = TRUE, prob = 1 / seq_len(nt))
+
+for (n in 2:3) {
+    ngrams <- lapply(seq_len(length(toks) - n + 1)[1:1e6], function(i) toks[i:(i + n - 1)])
+    res <- bench_hash_ngram(ngrams)
+    cat(n, "-grams\n", sep = "")
+    print(sapply(res, function(x) unlist(x[c("unique", "unique_hash", "max_bucket_length", "lookup_per_sec")])))
+    print(lapply(res, function(x) head(x$bucket_length, 10)))
+}
+
+# pairs of token IDs above 65535 as in fcm()
+x <- head(toks, -1)
+y <- tail(toks, -1) + 65536L
+res <- bench_hash_pair(x, y)
+print(sapply(res, function(x) unlist(x[c("unique", "unique_hash", "max_bucket_length", "lookup_per_sec")])))
+*/
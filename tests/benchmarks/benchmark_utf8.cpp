@@ -0,0 +1,102 @@
+// Throughput of UTF-8 functions used in index_types() and the tokenizers
+// Run Rcpp::sourceCpp("tests/benchmarks/benchmark_utf8.cpp")
+#include "lib.h"
+#include "utf8.h"
+#include <chrono>
+// [[Rcpp::depends(quanteda, RcppParallel, RcppArmadillo)]]
+using namespace quanteda;
+
+// the functions used until quanteda 4.0 that decode one byte at a time
+int utf8_length_old(std::string &text) {
+    int n = 0;
+    size_t i = 0;
+    while (i < text.length()) {
+        int cplen = 0;
+        if ((text[i] & 0xf8) == 0xf0) {
+            cplen = 4;   
+        } else if ((text[i] & 0xf0) == 0xe0) {
+            cplen = 3;   
+        } else if ((text[i] & 0xe0) == 0xc0) {
+            cplen = 2;
+        } else if ((text[i] & 0x80) == 0) {
+            cplen = 1;
+        }
+        if (cplen > 0) {
+            n++;
+        }
+        i += cplen;
+    }
+    return(n);
+}
+
+std::string utf8_sub_left_old(std::string &text, int len = 0) {
+    int n = 0;
+    size_t i = 0;
+    while (i < text.length()) {
+        int cplen = 0;
+        if ((text[i] & 0xf8) == 0xf0) {
+            cplen = 4;   
+        } else if ((text[i] & 0xf0) == 0xe0) {
+            cplen = 3;   
+        } else if ((text[i] & 0xe0) == 0xc0) {
+            cplen = 2;
+        } else if ((text[i] & 0x80) == 0) {
+            cplen = 1;
+        }
+        if (cplen > 0) {
+            n++;
+        }
+        if (n > len)
+            return text.substr(0, i);
+        i += cplen;
+    }
+    return text;
+}
+
+template <typename F>
+double mb_per_sec(Types &types, F fun) {
+    std::size_t bytes = 0, n = 0;
+    for (auto &type : types)
+        bytes += type.size();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < 10; r++) {
+        for (auto &type : types)
+            n += fun(type);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double sec = std::chrono::duration<double>(end - start).count();
+    if (n == 0) 
+        Rcout << ""; // keep the loop
+    return bytes * 10 / sec / 1e6;
+}
+
+// [[Rcpp::export]]
+DataFrame bench_utf8(const CharacterVector types_) {
+    Types types = Rcpp::as<Types>(types_);
+    NumericVector old_ = NumericVector::create(
+        mb_per_sec(types, [](std::string &x) { return utf8_length_old(x); }),
+        mb_per_sec(types, [](std::string &x) { return utf8_sub_left_old(x, 3).size(); }),
+        NA_REAL, NA_REAL
+    );
+    NumericVector new_ = NumericVector::create(
+        mb_per_sec(types, [](std::string &x) { return utf8_length(x); }),
+        mb_per_sec(types, [](std::string &x) { return utf8_sub_left(x, 3).size(); }),
+        mb_per_sec(types, [](std::string &x) { return utf8_sub_right(x, 3).size(); }),
+        mb_per_sec(types, [](std::string &x) { return (int)utf8_valid(x.data(), x.size()); })
+    );
+    return DataFrame::create(_["function"] = CharacterVector::create("length", "sub_left", 
+                                                                      "sub_right", "valid"),
+                             _["old_MBps"] = old_, 
+                             _["new_MBps"] = new_);
+}
+
+/***R
+set.seed(1234)
+# short types as in vocabularies and long texts
+type_ascii <- stringi::stri_rand_strings(1e6, 1:20)
+type_utf8 <- stringi::stri_rand_strings(1e6, 1:20, "[\\p{Han}\\p{Latin}]")
+text <- stringi::stri_rand_strings(1e3, 1e4, "[\\p{Han}\\p{Latin}]")
+bench_utf8(type_ascii)
+bench_utf8(type_utf8)
+bench_utf8(text)
+*/